@@ -1,5 +1,17 @@
 ﻿#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
 #include "example.hpp"          // Include short list of convenience functions for rendering
+#include "frame-acquisition.hpp" // Blocking frame acquisition and processing-thread load measurement
+#include "latest-mailbox.hpp"    // Latest-wins frame handoff between threads
+#include "filter-chain.hpp"      // Depth post-processing chain, sequential or pipelined
+#include "color-mask.hpp"        // RGB -> Lab box classification lookup table
+#include "blob-detection.hpp"    // Single-pass blob extraction on binary masks
+#include "tracking-output.hpp"   // Lock-free ring of tracking results for the robot side
+#include "latency-stats.hpp"     // Per-stage latency histograms
+#include "trace-export.hpp"      // Chrome trace / Perfetto export of pipeline spans
+#include "gl-renderer.hpp"       // Shader-based drawing of images and overlays
+#include "headless-run.hpp"      // Config files, result files and stop conditions of unattended runs
+#include "ray-table.hpp"         // Per-pixel rays for deprojection without the distortion model
+#include "depth-sampler.hpp"     // Median depth over a blob's pixels
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -15,6 +27,7 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <climits>
 
 
 // uncoment to enable opencv blob prieview window with sliders
@@ -32,8 +45,15 @@ int Inertia_min = 60;
 int maxDistancePixels = 30;
 int maxHoldFrames = 15;
 
-cv::Ptr<cv::SimpleBlobDetector> blobDetector;
 cv::SimpleBlobDetector::Params blobParams;
+binary_blob_detector blobExtractor;
+// only used to compare against (--compare-detectors)
+cv::Ptr<cv::SimpleBlobDetector> blobDetector;
+
+// RGB -> "inside the tracked Lab range" classification
+lab_box_lut colorTable;
+// Dilation of the mask by dilate_size, fused with its inversion
+rect_dilation maskDilation;
 
 
 using pixel = std::pair<int, int>;
@@ -51,6 +71,17 @@ struct state {
     cv::Vec3b trackColorLab{ 0, 0, 0 };
     cv::KeyPoint lastBlobCenter;
     int blobHoldFrames;
+    tracking_window blobWindow; // search window around lastBlobCenter while tracking
+    latest_mailbox<pixel> clicks; // from the GLFW callbacks to the tracking thread
+    std::atomic_bool dump_latency{ false }; // set by the L key, the main loop prints the latency histograms
+};
+
+// What the tracking thread hands to the main thread for display
+struct tracking_result {
+    unsigned long long frame_number = 0;
+    bool tracking = false;
+    float pixel[2] = { 0, 0 };
+    fixed_text<256> text{ "Not tracking" };
 };
 
 state app_state;
@@ -58,15 +89,9 @@ state app_state;
 // Helper function to register to UI events
 void register_glfw_callbacks(window& app, state& app_state);
 
-// draws openGL cross
-void drawCross(int centerX, int centerY);
-
 // transforms from sensor coordinate frame to robot coordinate frame
 void transformPoint(const float sourcePoint[3], float destPoint[3]);
 
-// Find closest blob keypoint
-cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const pixel& pixel, int maxDistance);
-cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const cv::KeyPoint& referenceKeypoint, int maxDistance);
 // Converts Keypoint coordinates to pixel
 pixel keypointToPixel(const cv::KeyPoint& keypoint);
 
@@ -90,88 +115,138 @@ void cv_blob_slider_circ_min(int value, void* userdata) {
     if (value == 0) value = 1;
     blobParams.minCircularity = value / 100.0f;
     blobDetector = cv::SimpleBlobDetector::create(blobParams);
+    blobExtractor.set_params(blobParams);
 }
 
 void cv_blob_slider_convex_min(int value, void* userdata) {
     if (value == 0) value = 1;
     blobParams.minConvexity = value / 100.0f;
     blobDetector = cv::SimpleBlobDetector::create(blobParams);
+    blobExtractor.set_params(blobParams);
 }
 
 void cv_blob_slider_inertia_min(int value, void* userdata) {
     if (value == 0) value = 1;
     blobParams.minInertiaRatio = value / 100.0f;
     blobDetector = cv::SimpleBlobDetector::create(blobParams);
+    blobExtractor.set_params(blobParams);
 }
 #endif
 
 int main(int argc, char* argv[]) try
 {
+    // Pass --config <file> to read any of the flags below from a key = value file as well
+    run_config config(argc, argv);
+    argc = config.argc();
+    argv = config.argv();
+
+    // Pass --headless to track without a window (no textures, no colorizer, no OpenCV preview).
+    // The target comes from --click / --color, the results go to --output, the run ends with the recording,
+    // after --duration <s> or on Ctrl+C
+    bool headless = has_flag(argc, argv, "--headless");
+
+    // Pass --playback <file.bag> to run on a recording instead of a live camera,
+    // or --synthetic WxH@fps to run on a rendered scene without any hardware
+    source_options source_opts = parse_source_options(argc, argv);
+
     std::string serial;
-    if (!device_with_streams({ RS2_STREAM_COLOR,RS2_STREAM_DEPTH }, serial))
+    if (source_opts.live() && !device_with_streams({ RS2_STREAM_COLOR,RS2_STREAM_DEPTH }, serial))
         return EXIT_SUCCESS;
 
     // OpenGL textures for the color and depth frames
     texture depth_image, color_image;
 
-    // Colorizer is used to visualize depth data
-    rs2::colorizer color_map;
-    // Use black to white color map
-    color_map.set_option(RS2_OPTION_COLOR_SCHEME, 2.f);
-    // Decimation filter reduces the amount of data (while preserving best samples)
-    rs2::decimation_filter dec;
-    // If the demo is too slow, make sure you run in Release (-DCMAKE_BUILD_TYPE=Release)
-    // but you can also increase the following parameter to decimate depth more (reducing quality)
-    dec.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2);
-    // Define transformations from and to Disparity domain
-    rs2::disparity_transform depth2disparity;
-    rs2::disparity_transform disparity2depth(false);
-    // Define spatial filter (edge-preserving)
-    rs2::spatial_filter spat;
-    // Enable hole-filling
-    // Hole filling is an agressive heuristic and it gets the depth wrong many times
-    // However, this demo is not built to handle holes
-    // (the shortest-path will always prefer to "cut" through the holes since they have zero 3D distance)
-    spat.set_option(RS2_OPTION_HOLES_FILL, 5); // 5 = fill all the zero pixels
-    // Define temporal filter
-    rs2::temporal_filter temp;
-    // Spatially align all streams to depth viewport
-    // We do this because:
-    //   a. Usually depth has wider FOV, and we only really need depth for this demo
-    //   b. We don't want to introduce new holes
-    rs2::align align_to_color(RS2_STREAM_COLOR);
-
-    // Declare RealSense pipeline, encapsulating the actual device and sensors
-    rs2::pipeline pipe;
-
-    rs2::config cfg;
-    if (!serial.empty())
-        cfg.enable_device(serial);
-
-    cfg.enable_stream(RS2_STREAM_DEPTH, 1280, 720, RS2_FORMAT_Z16, 30);
-    cfg.enable_stream(RS2_STREAM_COLOR, 1280, 720, RS2_FORMAT_RGB8, 30);
-    cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
-
-    auto profile = pipe.start(cfg);
-
-    auto sensor = profile.get_device().first<rs2::depth_sensor>();
+    // Depth post-processing (align, disparity, spatial, temporal, colorizer unless headless).
+    // Streams are aligned to the color viewport, blob tracking works on color pixels
+    post_processing_chain processing(RS2_STREAM_COLOR, !headless);
+    // Pass --budget <ms> to let the chain decimate depth whenever processing takes longer than that
+    if (auto budget = flag_value(argc, argv, "--budget"))
+        processing.decimation.set_budget(std::atof(budget));
+
+    // Declare RealSense pipeline, encapsulating the actual device and sensors (or a recording, or the synthetic scene)
+    frame_source source(source_opts);
+
+    source.start([&](rs2::config& cfg) {
+        if (!serial.empty())
+            cfg.enable_device(serial);
+
+        cfg.enable_stream(RS2_STREAM_DEPTH, 1280, 720, RS2_FORMAT_Z16, 30);
+        cfg.enable_stream(RS2_STREAM_COLOR, 1280, 720, RS2_FORMAT_RGB8, 30);
+        cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
+        });
+
+    auto sensor = source.get_device().first<rs2::depth_sensor>();
 
     // Set the device to High Accuracy preset of the D400 stereoscopic cameras
-    if (sensor && sensor.is<rs2::depth_stereo_sensor>())
+    // (a recording replays the settings it was captured with)
+    if (source.is_live() && sensor && sensor.is<rs2::depth_stereo_sensor>())
     {
         sensor.set_option(RS2_OPTION_VISUAL_PRESET, RS2_RS400_VISUAL_PRESET_HIGH_ACCURACY);
     }
 
-    auto stream = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+    auto stream = source.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+    // The OpenCV stage wraps the color buffer as 3-channel RGB
+    if (source.get_stream(RS2_STREAM_COLOR).format() != RS2_FORMAT_RGB8)
+        throw std::runtime_error("BlobTracker requires an RGB8 color stream");
 
-    
-    // Create a simple OpenGL window for rendering:
-    window app(stream.width(), stream.height(), "BlobTracker");
 
+    // Create a simple OpenGL window for rendering (none in headless runs)
+    std::unique_ptr<window> app_window;
+    // Images, HUD panel, crosshair, axes and text, batched into a few draw calls per frame
+    std::unique_ptr<gl_renderer> overlay;
+    if (!headless)
+    {
+        app_window.reset(new window(stream.width(), stream.height(), "BlobTracker"));
+        overlay.reset(new gl_renderer());
+        register_glfw_callbacks(*app_window, app_state);
+    }
 
-    register_glfw_callbacks(app, app_state);
-
-    rs2::frame_queue postprocessed_frames;
+    // Target without a mouse: --click X,Y acts like a click on the first frame, --color R,G,B tracks that color
+    // from the start, at the blob closest to the click or anywhere in the frame without one, and searches the
+    // whole frame for it again whenever the blob is lost. Thresholds: --threshold-l, --threshold-ab, --dilate
+    pixel target_click;
+    auto click_value = flag_value(argc, argv, "--click");
+    bool has_target_click = parse_pixel(click_value, target_click);
+    if (click_value && !has_target_click)
+        throw std::runtime_error("--click expects X,Y, e.g. 640,360");
+    int target_rgb[3];
+    auto target_color = flag_value(argc, argv, "--color");
+    bool has_target_color = target_color && std::sscanf(target_color, "%d,%d,%d", &target_rgb[0], &target_rgb[1], &target_rgb[2]) == 3;
+    if (target_color && !has_target_color)
+        throw std::runtime_error("--color expects R,G,B, e.g. 200,40,40");
+    if (headless && !has_target_click && !has_target_color && !source.synthetic())
+        throw std::runtime_error("A headless run needs a target: --click X,Y and/or --color R,G,B");
+    auto color_stream = source.get_stream(RS2_STREAM_COLOR).as<rs2::video_stream_profile>();
+    if (has_target_click && (target_click.first < 0 || target_click.second < 0
+        || target_click.first >= color_stream.width() || target_click.second >= color_stream.height()))
+        throw std::runtime_error("--click " + std::string(click_value) + " is outside the " + std::to_string(color_stream.width())
+            + "x" + std::to_string(color_stream.height()) + " color frame");
+    if (has_target_color && !has_target_click)
+        target_click = { color_stream.width() / 2, color_stream.height() / 2 };
+    if (has_target_click || has_target_color)
+        app_state.clicks.publish(target_click);
+    // Distance from the click within which a blob is acquired
+    std::atomic<int> acquire_distance{ has_target_color && !has_target_click ? INT_MAX : maxDistancePixels };
+    if (auto value = flag_value(argc, argv, "--threshold-l"))
+        threshold_LAB_L = std::atoi(value);
+    if (auto value = flag_value(argc, argv, "--threshold-ab"))
+        threshold_LAB_AB = std::atoi(value);
+    if (auto value = flag_value(argc, argv, "--dilate"))
+        dilate_size = std::max(0, std::atoi(value));
+
+    // Pass --output <file.csv | file.jsonl | -> to write every tracking result, headless runs write JSON Lines
+    // to stdout by default (the reports then go to stderr)
+    std::unique_ptr<result_sink> results;
+    auto output = flag_value(argc, argv, "--output");
+    if (output || headless)
+        results.reset(new result_sink(output ? output : "-"));
+    std::ostream& reports = results && results->to_stdout() ? std::cerr : std::cout;
+
+    // Newest processed frameset, older ones are dropped (and counted) if the main loop falls behind
+    latest_mailbox<rs2::frameset> postprocessed_frames;
+    // Same for the tracking thread, which hands its newest result to the main loop in turn
+    latest_mailbox<rs2::frameset> tracking_frames;
+    latest_mailbox<tracking_result> tracking_results;
 
     std::atomic_bool alive{ true };
 
@@ -200,114 +275,183 @@ int main(int argc, char* argv[]) try
     blobParams.minInertiaRatio = Inertia_min/100.0f;
     blobParams.maxInertiaRatio = 1.0f;
     blobDetector = cv::SimpleBlobDetector::create(blobParams);
+    blobExtractor.set_params(blobParams);
+
+    // Pass --compare-detectors to also run cv::SimpleBlobDetector on every mask and report both
+    // (use with --playback to benchmark on recorded frames)
+    bool compare_detectors = has_flag(argc, argv, "--compare-detectors");
+    detector_comparison detector_stats;
+
+    // Send resulting frames to the tracking thread and for visualization in the main thread.
+    // When a recording is replayed in lockstep wait until the tracking thread has picked the frameset up,
+    // so that every frame gets tracked (the display may still skip some)
+    std::atomic_bool source_done{ false };
+    // Pass --trace <file.json> to record every stage of every frame, to open in ui.perfetto.dev or chrome://tracing
+    auto tracer = trace_from_command_line(argc, argv);
+    auto publish_frames = [&](const rs2::frameset& data) {
+        trace_span span(tracer.get(), "publish", latency_stats::frame_key(data));
+        tracking_frames.publish(data);
+        if (!headless)
+            postprocessed_frames.publish(data);
+        if (source.lockstep())
+            while (alive && !tracking_frames.wait_taken(std::chrono::milliseconds(ACQUISITION_TIMEOUT_MS))) {}
+    };
+
+    // Pass --poll to fall back to the old busy-polling loop (for comparing CPU load and latency)
+    bool busy_poll = has_flag(argc, argv, "--poll");
+
+    // Latency from the sensor timestamp to the end of every stage, press L to print it
+    latency_stats latency;
+    const size_t latency_acquisition = latency.add_stage("acquisition");
+    const size_t latency_first_filter = latency.stages();
+    for (size_t i = 0; i < processing.size(); i++)
+        latency.add_stage(processing.step_name(i));
+    const size_t latency_handoff = latency.add_stage("handoff");
+    const size_t latency_mask = latency.add_stage("Lab mask");
+    const size_t latency_blobs = latency.add_stage("blob detection");
+    const size_t latency_deprojection = latency.add_stage("deprojection");
+    const size_t latency_render = latency.add_stage("render");
+    processing.on_step_done([&](size_t step, const rs2::frameset& data, std::chrono::steady_clock::time_point start) {
+        auto key = latency_stats::frame_key(data);
+        latency.stamp(latency_first_filter + step, key);
+        if (tracer)
+            tracer->span(processing.step_name(step).c_str(), key, monotonic_us(start), monotonic_us());
+        });
 
-    //opencv window
- #ifdef CV_WINDOW
-    const auto window_name = "OpenCV Image";
-    cv::namedWindow(window_name, cv::WINDOW_AUTOSIZE);
-    cv::createTrackbar("L* Th", "OpenCV Image", &threshold_LAB_L, 255, cv_slider_1);
-    cv::createTrackbar("a*, b* Th", "OpenCV Image", &threshold_LAB_AB, 255, cv_slider_2);
-    cv::createTrackbar("dilate it", "OpenCV Image", &dilate_size, 21, cv_dilate_dilate_slider);
-    cv::createTrackbar("minConvex", "OpenCV Image", &Convexity_min, 100, cv_blob_slider_convex_min);
-    cv::createTrackbar("minCircle", "OpenCV Image", &Circularity_min, 100, cv_blob_slider_circ_min);
-    cv::createTrackbar("minInertia", "OpenCV Image", &Inertia_min, 100, cv_blob_slider_inertia_min);
-    
- #endif
-    
-        
-    
+    // Pass --pipelined to run the post-processing steps on one worker thread per stage:
+    // align + decimation | disparity + spatial | temporal + depth | colorizer
+    std::unique_ptr<pipelined_chain> pipelined_processing;
+    if (has_flag(argc, argv, "--pipelined"))
+        pipelined_processing.reset(new pipelined_chain(processing, { 2, 2, 2, 1 }, publish_frames));
 
     // Video-processing thread will fetch frames from the camera,
     // apply post-processing and send the result to the main thread for rendering
     // It recieves synchronized (but not spatially aligned) pairs
     // and outputs synchronized and aligned pairs
     std::thread video_processing_thread([&]() {
+        acquisition_meter meter(busy_poll ? "Processing thread (polling)" : "Processing thread (blocking)");
+        if (tracer) tracer->name_thread("video processing");
         while (alive)
         {
-            // Fetch frames from the pipeline and send them for processing
+            // Fetch frames from the pipeline and send them for processing.
+            // Block until the next frameset arrives (or the timeout expires so that alive is re-checked)
+            // instead of spinning on poll_for_frames
             rs2::frameset data;
-            if (pipe.poll_for_frames(&data))
+            if (busy_poll ? source.poll(data) : source.wait(data))
             {
-                // First make the frames spatially aligned
-                data = data.apply_filter(align_to_color);
-
-                // Decimation will reduce the resultion of the depth image,
-                // closing small holes and speeding-up the algorithm
-                //data = data.apply_filter(dec);
-
-                // To make sure far-away objects are filtered proportionally
-                // we try to switch to disparity domain
-                data = data.apply_filter(depth2disparity);
-                // Apply spatial filtering
-                data = data.apply_filter(spat);
-
-                // Apply temporal filtering
-                data = data.apply_filter(temp);
-
-                // If we are in disparity domain, switch back to depth
-                data = data.apply_filter(disparity2depth);
-
-                //// Apply color map for visualization of depth
-                data = data.apply_filter(color_map);
-
-                
-
-                // Send resulting frames for visualization in the main thread
-                postprocessed_frames.enqueue(data);
+                latency.begin(data, latency_acquisition);
+                if (pipelined_processing)
+                {
+                    // Hand the frameset to the first stage, the last stage publishes the result
+                    pipelined_processing->push(data);
+                }
+                else
+                {
+                    data = processing.process(data);
+                    publish_frames(data);
+                }
+                meter.frame_done(data);
+            }
+            else if (source.finished())
+            {
+                // End of the recording, flush the frames still in the pipeline and let the main loop exit
+                if (pipelined_processing)
+                    pipelined_processing->finish();
+                source_done = true;
+                break;
             }
         }
+        meter.report(reports);
         });
 
-    rs2::frameset current_frameset;
-    cv::Mat cvColor;
-    std::string str_tracked = "Not tracking";
-    float trackedPixel[2];
-    float trackedPoint[3];
-    float outputPoint[3] = { 0,0,0 };
-    // && cv::waitKey(1) < 0 && cv::getWindowProperty(window_name, cv::WND_PROP_AUTOSIZE) >= 0 - for openCV test window
-    while (app) // Application still alive?
+    // Tracking results are scored against the ground truth when running on the synthetic scene
+    tracking_accuracy accuracy;
+
+    // Every tracking result in order, from the tracking thread to the controller thread
+    tracking_output tracked_points;
+    // and the latest ones to other processes through shared memory (pass --shm <name> to rename the segment)
+    // Tracking goes on without it if the segment can not be created (owned by another user, no /dev/shm)
+    auto shm_name = flag_value(argc, argv, "--shm");
+    std::unique_ptr<shared_pose_writer> pose_writer;
+    try
+    {
+        pose_writer.reset(new shared_pose_writer(shm_name ? shm_name : SHARED_POSE_DEFAULT_NAME));
+    }
+    catch (const std::exception& e)
     {
-        // Fetch the latest available post-processed frameset
+        reports << "Warning: poses are not published to shared memory: " << e.what() << std::endl;
+    }
 
-        postprocessed_frames.poll_for_frame(&current_frameset);
+    // Tracking thread runs the OpenCV stage on the newest processed frameset and hands the result to the
+    // main thread, so that rendering and vsync can not delay the tracking output (and vice versa)
+    std::thread tracking_thread([&]() {
+        acquisition_meter meter("Tracking thread");
+        if (tracer) tracer->name_thread("tracking");
 
-        if (current_frameset)
+        //opencv window
+#ifdef CV_WINDOW
+        // created by this thread, so that HighGUI runs the slider callbacks here as well
+        const auto window_name = "OpenCV Image";
+        if (!headless)
         {
-            auto depth = current_frameset.get_depth_frame();
-            auto color = current_frameset.get_color_frame();
-            auto colorized_depth = current_frameset.first(RS2_STREAM_DEPTH, RS2_FORMAT_RGB8);
-            auto accel_frame = current_frameset.first_or_default(RS2_STREAM_ACCEL);
-           
-            rs2_vector accel_data = accel_frame.as<rs2::motion_frame>().get_motion_data();
-            // Calculate pitch and roll in radians
-            float yaw = atan2(-accel_data.x, sqrt(accel_data.y * accel_data.y + accel_data.z * accel_data.z));
-            float roll = atan2(accel_data.y, accel_data.z);
+            cv::namedWindow(window_name, cv::WINDOW_AUTOSIZE);
+            cv::createTrackbar("L* Th", "OpenCV Image", &threshold_LAB_L, 255, cv_slider_1);
+            cv::createTrackbar("a*, b* Th", "OpenCV Image", &threshold_LAB_AB, 255, cv_slider_2);
+            cv::createTrackbar("dilate it", "OpenCV Image", &dilate_size, 21, cv_dilate_dilate_slider);
+            cv::createTrackbar("minConvex", "OpenCV Image", &Convexity_min, 100, cv_blob_slider_convex_min);
+            cv::createTrackbar("minCircle", "OpenCV Image", &Circularity_min, 100, cv_blob_slider_circ_min);
+            cv::createTrackbar("minInertia", "OpenCV Image", &Inertia_min, 100, cv_blob_slider_inertia_min);
+        }
+#endif
 
-            // Convert radians to degrees
-            float yaw_deg = (float)(yaw * (180.0f / M_PI));
-            float roll_deg = (float)(roll * (180.0f / M_PI));
-            // Adjust roll by 90 degrees for horizontal alignment
-            roll_deg += 90.0f;
+        fixed_text<256> str_tracked("Not tracking");
+        float trackedPixel[2];
+        float trackedPoint[3];
+        float outputPoint[3] = { 0,0,0 };
+        // rebuilt only when the depth intrinsics change (decimation)
+        ray_table depth_rays;
+        // depth of the blob from all of its mask pixels
+        depth_sampler blob_depth(depth_sampler::median);
+        rs2::frameset frames;
+        while (alive)
+        {
+            if (!tracking_frames.wait_take(frames, nullptr, std::chrono::milliseconds(ACQUISITION_TIMEOUT_MS)))
+                continue;
 
-            if (roll_deg > 180.0f) {
-                roll_deg -= 360.0f;
-            }
+            auto depth = frames.get_depth_frame();
+            auto color = frames.get_color_frame();
+            auto frame_key = color.get_frame_number();
+            latency.stamp(latency_handoff, frame_key);
+            trace_span frame_span(tracer.get(), "tracking", frame_key);
+
+            // Clicks arrive from the main thread
+            if (app_state.clicks.try_take(app_state.last_click))
+                app_state.new_click = true;
 
             // OpenCV
 
-            // convert rs color frame to cv Lab colors
+            // wrap rs color frame, it is classified straight from RGB (no full-frame Lab conversion)
             cv::Mat r_rgb = cv::Mat(cv::Size(color.get_width(), color.get_height()), CV_8UC3, (void*)color.get_data(), cv::Mat::AUTO_STEP);
-            cv::Mat cvColor;
-            cvtColor(r_rgb, cvColor, cv::COLOR_RGB2Lab);
-            
+
+            // Synthetic scene: nobody is there to click, start tracking at the sphere's true position
+            ground_truth truth;
+            bool has_truth = source.synthetic() && source.synthetic()->get_ground_truth(color.get_frame_number(), truth);
+            if (has_truth && !app_state.tracking && !app_state.start_tracking && !app_state.new_click)
+            {
+                app_state.last_click = { int(truth.pixel[0] + 0.5f), int(truth.pixel[1] + 0.5f) };
+                app_state.new_click = true;
+            }
 
             if (app_state.new_click)
             {
                 float pixel[2] = { float(app_state.last_click.first), float(app_state.last_click.second) };
                 float point[3];
 
-                // openCV get pixel color
-                app_state.trackColorLab = cvColor.at<cv::Vec3b>(app_state.last_click.second, app_state.last_click.first);
+                // openCV get pixel color (or the one given with --color)
+                if (has_target_color)
+                    app_state.trackColorLab = rgb_to_lab(cv::Vec3b(uint8_t(target_rgb[0]), uint8_t(target_rgb[1]), uint8_t(target_rgb[2])));
+                else
+                    app_state.trackColorLab = rgb_to_lab(r_rgb.at<cv::Vec3b>(app_state.last_click.second, app_state.last_click.first));
                 // set color range and enable tracking
                 app_state.trackLABmin = cv::Scalar(app_state.trackColorLab[0] - threshold_LAB_L, app_state.trackColorLab[1] - threshold_LAB_AB, app_state.trackColorLab[2] - threshold_LAB_AB);
                 app_state.trackLABmax = cv::Scalar(app_state.trackColorLab[0] + threshold_LAB_L, app_state.trackColorLab[1] + threshold_LAB_AB, app_state.trackColorLab[2] + threshold_LAB_AB);
@@ -317,134 +461,323 @@ int main(int argc, char* argv[]) try
             }
 
             // OpenCV
-            // perform color separation
+            // once locked on, only look around the blob, search the full frame to acquire it
+            cv::Rect roi(0, 0, r_rgb.cols, r_rgb.rows);
+            if (app_state.tracking)
+                roi = app_state.blobWindow.window(app_state.lastBlobCenter, maxDistancePixels, dilate_size, roi.size());
+
+            // perform color separation, the table is only rebuilt when the color or the thresholds change
+            trace_span mask_span(tracer.get(), "Lab mask", frame_key);
             cv::Mat maskLAB;
-            cv::inRange(cvColor, app_state.trackLABmin, app_state.trackLABmax, maskLAB);
+            colorTable.update(app_state.trackLABmin, app_state.trackLABmax);
+            colorTable.apply(r_rgb(roi), maskLAB);
 
-            cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT,
-                cv::Size(2 * dilate_size + 1, 2 * dilate_size + 1),
-                cv::Point(dilate_size, dilate_size));
-            cv::dilate(maskLAB, maskLAB, element);
-            maskLAB = 255 - maskLAB;
+            // dilate and invert in one pass, the cost does not depend on dilate_size
+            maskDilation.apply(maskLAB, maskLAB, dilate_size, true);
+            latency.stamp(latency_mask, frame_key);
+            mask_span.end();
             // perform blob detection
+            trace_span blobs_span(tracer.get(), "blob detection", frame_key);
             std::vector<cv::KeyPoint> keypoints;
-            blobDetector->detect(maskLAB, keypoints);
+            auto detect_start = std::chrono::steady_clock::now();
+            blobExtractor.detect(maskLAB, keypoints);
+            if (compare_detectors)
+            {
+                auto detect_end = std::chrono::steady_clock::now();
+                std::vector<cv::KeyPoint> reference;
+                blobDetector->detect(maskLAB, reference);
+                auto reference_end = std::chrono::steady_clock::now();
+                detector_stats.add(std::chrono::duration<double, std::milli>(detect_end - detect_start).count(),
+                    std::chrono::duration<double, std::milli>(reference_end - detect_end).count(), keypoints, reference);
+            }
+            // back to frame coordinates
+            for (auto& keypoint : keypoints)
+            {
+                keypoint.pt.x += roi.x;
+                keypoint.pt.y += roi.y;
+            }
+            latency.stamp(latency_blobs, frame_key);
+            blobs_span.end();
 
 
             pixel blobCenterPixel = keypointToPixel(app_state.lastBlobCenter);
             trackedPixel[0] = blobCenterPixel.first;
             trackedPixel[1] = blobCenterPixel.second;
+            bool point_valid = false;
 
             if (app_state.tracking) {
                 try {
-                    app_state.lastBlobCenter = findClosestKeypoint(keypoints, app_state.lastBlobCenter, maxDistancePixels);
+                    app_state.lastBlobCenter = findClosestKeypoint(keypoints, app_state.lastBlobCenter, int(app_state.blobWindow.reach(maxDistancePixels)));
+                    app_state.blobWindow.found(app_state.lastBlobCenter);
                     app_state.blobHoldFrames = maxHoldFrames;
-                    str_tracked = "Blob u: " + std::to_string(blobCenterPixel.first) + ", v: " + std::to_string(blobCenterPixel.second);
-                    auto intr = depth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
-                    // Get distance at pixel coordinates
-                    float distance = depth.get_distance(app_state.last_click.first, app_state.last_click.second);
+                    // the blob found in this frame
+                    blobCenterPixel = keypointToPixel(app_state.lastBlobCenter);
+                    trackedPixel[0] = blobCenterPixel.first;
+                    trackedPixel[1] = blobCenterPixel.second;
+                    str_tracked.format("Blob u: %d, v: %d", blobCenterPixel.first, blobCenterPixel.second);
+                    depth_rays.update(depth);
+                    // Depth may be decimated, scale color pixels to depth pixels
+                    float depth_scale_x = float(depth.get_width()) / color.get_width();
+                    float depth_scale_y = float(depth.get_height()) / color.get_height();
+                    float depthPixel[2] = { trackedPixel[0] * depth_scale_x, trackedPixel[1] * depth_scale_y };
+                    // Median depth of the blob's mask pixels within its radius
+                    blob_footprint footprint;
+                    footprint.center[0] = app_state.lastBlobCenter.pt.x;
+                    footprint.center[1] = app_state.lastBlobCenter.pt.y;
+                    footprint.radius = app_state.lastBlobCenter.size / 2;
+                    footprint.mask = maskLAB.data;
+                    footprint.mask_stride = int(maskLAB.step);
+                    footprint.mask_x = roi.x;
+                    footprint.mask_y = roi.y;
+                    footprint.mask_width = maskLAB.cols;
+                    footprint.mask_height = maskLAB.rows;
+                    footprint.value = uint8_t(blobExtractor.params().blobColor);
+                    auto sample = blob_depth.sample(depth, depth_scale_x, depth_scale_y, footprint);
+                    float distance = sample.depth;
                     if (distance > 0) {
-                        rs2_deproject_pixel_to_point(trackedPoint, &intr, trackedPixel, distance);
-                        str_tracked += ",\nx: " + std::to_string(trackedPoint[0]) + ",\ny: " + std::to_string(trackedPoint[1]) + ",\nz: " + std::to_string(trackedPoint[2]);
+                        depth_rays.deproject(depthPixel, distance, trackedPoint);
+                        str_tracked.append(",\nx: %f,\ny: %f,\nz: %f (%d px)", trackedPoint[0], trackedPoint[1], trackedPoint[2], sample.valid);
                         transformPoint(trackedPoint, outputPoint);
-                        str_tracked += "\nTransformed:\nx: " + std::to_string(outputPoint[0]) + ",\ny: " + std::to_string(outputPoint[1]) + ",\nz: " + std::to_string(outputPoint[2]);
-
+                        latency.stamp(latency_deprojection, frame_key);
+                        str_tracked.append("\nTransformed:\nx: %f,\ny: %f,\nz: %f", outputPoint[0], outputPoint[1], outputPoint[2]);
+                        if (has_truth) accuracy.add(truth, trackedPixel, trackedPoint);
+                        point_valid = true;
                     }
                     else {
-                        str_tracked += "\n Invalid depth\n";
+                        str_tracked.append("\n Invalid depth\n");
+                        if (has_truth) accuracy.add(truth, trackedPixel, nullptr);
                     }
 
                 } catch (const std::runtime_error& e) {
                     app_state.blobHoldFrames--;
+                    app_state.blobWindow.missed();
+                    if (has_truth) accuracy.add_missed();
                     if (app_state.blobHoldFrames <= 0) {
                         app_state.tracking = false;
-                        str_tracked = "Blob dropped";
+                        str_tracked.format("Blob dropped");
+                        if (has_target_color)
+                        {
+                            // nobody will click again, look for the color everywhere
+                            app_state.start_tracking = true;
+                            acquire_distance = INT_MAX;
+                        }
                     }
                     //std::cerr << "Error: " << e.what() << std::endl;
                 }
             } else if (app_state.start_tracking) {
 
                 try {
-                    app_state.lastBlobCenter = findClosestKeypoint(keypoints, app_state.last_click, maxDistancePixels);
+                    app_state.lastBlobCenter = findClosestKeypoint(keypoints, app_state.last_click, acquire_distance.load());
+                    app_state.blobWindow.reset(app_state.lastBlobCenter);
                     app_state.start_tracking = false;
                     app_state.tracking = true;
                     app_state.blobHoldFrames = maxHoldFrames;
                 }
                 catch (const std::runtime_error& e) {
-                    app_state.start_tracking = false;
-                    str_tracked = "Couldn`t start blob tracking";
+                    app_state.start_tracking = has_target_color; // keep looking for a given color
+                    str_tracked.format("Couldn`t start blob tracking");
                     //std::cerr << "Error: " << e.what() << std::endl;
                 }
             }
 
             // display mask with keypoints
 #ifdef CV_WINDOW
-            cv::Mat maskLAB_with_keypoints;
-            cv::drawKeypoints(maskLAB, keypoints, maskLAB_with_keypoints, cv::Scalar(0, 0, 255), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
-            cv::imshow(window_name, maskLAB_with_keypoints);
+            if (!headless)
+            {
+                trace_span preview_span(tracer.get(), "mask preview", frame_key);
+                // (the part outside the search window is left blank)
+                cv::Mat maskLAB_full(r_rgb.size(), CV_8UC1, cv::Scalar(255));
+                maskLAB.copyTo(maskLAB_full(roi));
+                cv::Mat maskLAB_with_keypoints;
+                cv::drawKeypoints(maskLAB_full, keypoints, maskLAB_with_keypoints, cv::Scalar(0, 0, 255), cv::DrawMatchesFlags::DRAW_RICH_KEYPOINTS);
+                cv::imshow(window_name, maskLAB_with_keypoints);
+                cv::pollKey(); // let HighGUI handle the events of its window (sliders)
+            }
 #endif
-            
 
-            glEnable(GL_BLEND);
-            // Use the Alpha channel for blending
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            // Publish the result of every frame, valid only if the blob was located and had depth
+            tracked_point point;
+            point.frame_number = color.get_frame_number();
+            point.timestamp = color.get_timestamp();
+            point.domain = color.get_frame_timestamp_domain();
+            point.pixel[0] = trackedPixel[0];
+            point.pixel[1] = trackedPixel[1];
+            point.valid = point_valid;
+            if (point_valid)
+            {
+                std::copy(trackedPoint, trackedPoint + 3, point.camera);
+                std::copy(outputPoint, outputPoint + 3, point.robot);
+            }
+            tracked_points.push(point);
+            if (pose_writer) pose_writer->publish(to_shared_pose(point));
+
+            tracking_result result;
+            result.frame_number = color.get_frame_number();
+            result.tracking = app_state.tracking;
+            result.pixel[0] = trackedPixel[0];
+            result.pixel[1] = trackedPixel[1];
+            result.text = str_tracked;
+            if (!headless)
+                tracking_results.publish(std::move(result));
+            meter.frame_done(frames);
+        }
+        meter.report(reports);
+        });
+
+    // Controller thread consumes the tracking results at tracker rate, without locks or allocations
+    std::atomic_bool tracking_done{ false };
+    tracking_consumer controller;
+    std::thread controller_thread([&]() {
+        auto consume = [&](const tracked_point& p) {
+            // hand the point to the robot controller here
+            controller.consume(p);
+            if (results)
+                write_tracked_point(*results, p);
+        };
+        while (!tracking_done)
+        {
+            if (!tracked_points.drain(consume))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        tracked_points.drain(consume);
+        });
+
+    rs2::frameset current_frameset;
+    unsigned long long current_sequence = 0;
+    tracking_result current_tracking;
+    if (tracer) tracer->name_thread("render");
+    long long swap_begin_us = -1;
+    // Headless: nothing to draw, the main thread waits for the end of the run
+    run_limit limit(argc, argv);
+    while (headless && !source_done && !limit.reached())
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // && cv::waitKey(1) < 0 && cv::getWindowProperty(window_name, cv::WND_PROP_AUTOSIZE) >= 0 - for openCV test window
+    while (app_window && *app_window && !source_done && !limit.reached()) // Application still alive?
+    {
+        auto& app = *app_window;
+        // window::operator bool swapped the buffers and polled the events
+        if (tracer && swap_begin_us >= 0)
+            tracer->span("swap buffers", trace_recorder::NO_FRAME, swap_begin_us, monotonic_us());
+        trace_span render_span(tracer.get(), "render");
+
+        // Fetch the latest available post-processed frameset,
+        // keep showing the previous one until a newer frameset arrives
+        postprocessed_frames.try_take(current_frameset, &current_sequence);
+        // and the latest tracking result, usually for the same or the previous frame
+        bool new_tracking = tracking_results.try_take(current_tracking);
+
+        if (current_frameset)
+        {
+            auto depth = current_frameset.get_depth_frame();
+            auto color = current_frameset.get_color_frame();
+            auto colorized_depth = current_frameset.first(RS2_STREAM_DEPTH, RS2_FORMAT_RGB8);
+            auto accel_frame = current_frameset.first_or_default(RS2_STREAM_ACCEL);
+           
+            // Recordings may not contain the motion stream
+            rs2_vector accel_data = { 0, 0, 0 };
+            if (auto motion = accel_frame.as<rs2::motion_frame>())
+                accel_data = motion.get_motion_data();
+            // Calculate pitch and roll in radians
+            float yaw = atan2(-accel_data.x, sqrt(accel_data.y * accel_data.y + accel_data.z * accel_data.z));
+            float roll = atan2(accel_data.y, accel_data.z);
+
+            // Convert radians to degrees
+            float yaw_deg = (float)(yaw * (180.0f / M_PI));
+            float roll_deg = (float)(roll * (180.0f / M_PI));
+            // Adjust roll by 90 degrees for horizontal alignment
+            roll_deg += 90.0f;
+
+            if (roll_deg > 180.0f) {
+                roll_deg -= 360.0f;
+            }
+
+
+            overlay->begin(app.width(), app.height());
 
             // First render the colorized depth image
-            depth_image.render(colorized_depth, { 0, 0, app.width(), app.height() });
+            depth_image.render(*overlay, colorized_depth, { 0, 0, app.width(), app.height() });
             
             // Render the color frame (since we have selected RGBA format
             // pixels out of FOV will appear transparent)
-            color_image.render(color, { 0, 0, app.width(), app.height() });
-
-            // Show stream resolutions
-            std::string depth_res = "Depth: " + std::to_string(depth.get_width()) + "x" + std::to_string(depth.get_height());
-            std::string color_res = "Color: " + std::to_string(color.get_width()) + "x" + std::to_string(color.get_height());
-            std::string str_roll = "Roll: " + std::to_string(roll_deg);
-            std::string str_yaw = "Yaw: " + std::to_string(yaw_deg);
+            color_image.render(*overlay, color, { 0, 0, app.width(), app.height() });
+
+            // Show stream resolutions (formatted in place, nothing is allocated per frame)
+            fixed_text<64> depth_res, color_res, frames_info, str_roll, str_yaw;
+            depth_res.format("Depth: %dx%d", depth.get_width(), depth.get_height());
+            if (processing.decimation.magnitude() > 1)
+                depth_res.append(" (decimated x%d)", processing.decimation.magnitude());
+            color_res.format("Color: %dx%d", color.get_width(), color.get_height());
+            frames_info.format("Frame #%llu, dropped: %llu", current_sequence, postprocessed_frames.dropped());
+            str_roll.format("Roll: %f", roll_deg);
+            str_yaw.format("Yaw: %f", yaw_deg);
             
-            // Set the drawing color to black with 50% transparency
-            glColor4f(0.0f, 0.0f, 0.0f, 0.5f); // RGBA
-
-            // Draw a filled rectangle using triangle fan
-            glBegin(GL_TRIANGLE_FAN);
-            glVertex2f(0.0f, 0.0f); // Top-left corner
-            glVertex2f(150.0f, 0.0f); // Top-right corner
-            glVertex2f(150.0f, 200.0f); // Bottom-right corner
-            glVertex2f(0.0f, 200.0f); // Bottom-left corner
-            glEnd();
-
-            if (app_state.tracking) drawCross(trackedPixel[0], trackedPixel[1]);
-
-            glColor3f(1.f, 1.f, 1.f);
-            draw_text(10, 10, depth_res.c_str());
-            draw_text(10, 20, color_res.c_str());
-            glColor3f(1.f, 0.f, 1.f);
-            draw_text(10, 50, str_roll.c_str());
-            glColor3f(0.f, 1.f, 1.f);
-            draw_text(10, 60, str_yaw.c_str());
-            glColor3f(1.f, 1.f, 0.f);
-            draw_text(10, 80, str_tracked.c_str());
-            // Draw intersecting lines
-            glLineWidth(1.0f); // Set line width
-            glBegin(GL_LINES);
-            // Y axis
-            glColor3f(0.0f, 1.0f, 0.0f);
-            glVertex2f(app.width() / 2.0f, 0.0f);
-            glVertex2f(app.width() / 2.0f, app.height());
-            // X axis
-            glColor3f(1.0f, 0.0f, 0.0f);
-            glVertex2f(0.0f, app.height() / 2.0f);
-            glVertex2f(app.width(), app.height() / 2.0f);
-            glEnd();
-
-            glColor3f(1.f, 1.f, 1.f);
-            glDisable(GL_BLEND);
+            // Black panel with 50% transparency behind the text
+            overlay->fill_rect(0.0f, 0.0f, 150.0f, 200.0f, { 0.0f, 0.0f, 0.0f, 0.5f });
+
+            if (current_tracking.tracking)
+                overlay->cross(current_tracking.pixel[0], current_tracking.pixel[1], 50.0f, 2.0f, { 1.0f, 1.0f, 1.0f, 1.0f });
+
+            // Intersecting lines through the center, Y axis then X axis
+            overlay->line(app.width() / 2.0f, 0.0f, app.width() / 2.0f, app.height(), 1.0f, { 0.0f, 1.0f, 0.0f, 1.0f });
+            overlay->line(0.0f, app.height() / 2.0f, app.width(), app.height() / 2.0f, 1.0f, { 1.0f, 0.0f, 0.0f, 1.0f });
+
+            const gl_renderer::color white = { 1.f, 1.f, 1.f, 1.f };
+            overlay->text(10, 10, depth_res.c_str(), white);
+            overlay->text(10, 20, color_res.c_str(), white);
+            overlay->text(10, 30, frames_info.c_str(), white);
+            overlay->text(10, 50, str_roll.c_str(), { 1.f, 0.f, 1.f, 1.f });
+            overlay->text(10, 60, str_yaw.c_str(), { 0.f, 1.f, 1.f, 1.f });
+            overlay->text(10, 80, current_tracking.text.c_str(), { 1.f, 1.f, 0.f, 1.f });
+
+            // Three draw calls: the two images, then every overlay shape and label at once
+            overlay->flush();
+            // (the frame is on screen after the next buffer swap)
+            if (new_tracking)
+                latency.stamp(latency_render, current_tracking.frame_number);
         }
+
+        if (app_state.dump_latency.exchange(false))
+            latency.report(reports);
+        render_span.end();
+        swap_begin_us = monotonic_us();
     }
 
     // Signal threads to finish and wait until they do
     alive = false;
     video_processing_thread.join();
+    tracking_thread.join();
+    tracking_done = true;
+    controller_thread.join();
+    if (pipelined_processing)
+    {
+        pipelined_processing->stop();
+        pipelined_processing->report(reports);
+    }
+    processing.report(reports);
+
+    if (!headless)
+        reports << "Processed framesets: " << postprocessed_frames.published()
+            << ", displayed: " << postprocessed_frames.consumed()
+            << ", dropped before display: " << postprocessed_frames.dropped() << std::endl;
+    detector_stats.report(reports);
+    controller.report(reports, tracked_points);
+    if (results)
+    {
+        results->flush();
+        results->report(reports);
+    }
+    latency.report(reports);
+    if (tracer)
+    {
+        tracer->close();
+        tracer->report(reports);
+    }
+    if (source.synthetic())
+    {
+        source.synthetic()->report(reports);
+        accuracy.report(reports);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -466,9 +799,9 @@ void register_glfw_callbacks(window& app, state& app_state)
         {
             if (pressed)
             {
-                // Use the last known mouse position as the click position
-                app_state.last_click = app_state.mouse_position;
-                app_state.new_click = true;
+                // Use the last known mouse position as the click position,
+                // the tracking thread picks it up with its next frame
+                app_state.clicks.publish(app_state.mouse_position);
             }
         };
 
@@ -477,36 +810,12 @@ void register_glfw_callbacks(window& app, state& app_state)
             // Continuously update the mouse position
             app_state.mouse_position = { static_cast<int>(x), static_cast<int>(y) };
         };
-}
-
-void drawCross(int centerX, int centerY) {
-    int halfSize = 50; // Half the size of the cross to center it around (centerX, centerY)
-
-    // Enable blending if you want anti-aliased lines
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Set line width if desired
-    glLineWidth(2.0f);
 
-    // Set color to white
-    glColor3f(1.0f, 1.0f, 1.0f);
-
-    // Start drawing lines
-    glBegin(GL_LINES);
-
-    // Horizontal line (left to right)
-    glVertex2f(centerX - halfSize, centerY);
-    glVertex2f(centerX + halfSize, centerY);
-
-    // Vertical line (bottom to top)
-    glVertex2f(centerX, centerY - halfSize);
-    glVertex2f(centerX, centerY + halfSize);
-
-    glEnd();
-
-    // Reset OpenGL states as necessary
-    glDisable(GL_BLEND);
+    app.on_key_release = [&](int key)
+        {
+            if (key == GLFW_KEY_L)
+                app_state.dump_latency = true;
+        };
 }
 
 void transformPoint(const float sourcePoint[3], float destPoint[3]) {
@@ -524,62 +833,6 @@ void transformPoint(const float sourcePoint[3], float destPoint[3]) {
     destPoint[2] = destPointH(2) / destPointH(3);
 }
 
-cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const pixel& pixel, int maxDistance) {
-    if (keypoints.empty()) {
-        throw std::runtime_error("The keypoints vector is empty.");
-    }
-
-    double minDistance = std::numeric_limits<double>::max();
-    cv::KeyPoint closestKeypoint;
-    bool found = false;
-
-    for (const auto& keypoint : keypoints) {
-        double dx = keypoint.pt.x - pixel.first;
-        double dy = keypoint.pt.y - pixel.second;
-        double distance = std::sqrt(dx * dx + dy * dy);
-
-        if (distance < minDistance) {
-            minDistance = distance;
-            closestKeypoint = keypoint;
-            found = true;
-        }
-    }
-
-    if (!found || minDistance > maxDistance) {
-        throw std::runtime_error("No keypoints found within the maximum distance.");
-    }
-
-    return closestKeypoint;
-}
-
-cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const cv::KeyPoint& referenceKeypoint, int maxDistance) {
-    if (keypoints.empty()) {
-        throw std::runtime_error("The keypoints vector is empty.");
-    }
-
-    double minDistance = std::numeric_limits<double>::max();
-    cv::KeyPoint closestKeypoint;
-    bool found = false;
-
-    for (const auto& keypoint : keypoints) {
-        double dx = keypoint.pt.x - referenceKeypoint.pt.x;
-        double dy = keypoint.pt.y - referenceKeypoint.pt.y;
-        double distance = std::sqrt(dx * dx + dy * dy);
-
-        if (distance < minDistance) {
-            minDistance = distance;
-            closestKeypoint = keypoint;
-            found = true;
-        }
-    }
-
-    if (!found || minDistance > maxDistance) {
-        throw std::runtime_error("No keypoints found within the maximum distance.");
-    }
-
-    return closestKeypoint;
-}
-
 pixel keypointToPixel(const cv::KeyPoint& keypoint) {
     // Convert float coordinates to integer coordinates
     int x = static_cast<int>(keypoint.pt.x + 0.5); // Adding 0.5 for rounding
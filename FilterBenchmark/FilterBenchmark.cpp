@@ -0,0 +1,231 @@
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+#include "frame-acquisition.hpp" // Recordings and synthetic frames
+#include "filter-chain.hpp"      // The post-processing chain used by the apps
+#include "ray-table.hpp"         // Per-pixel rays for deprojection
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+// Measures the ceiling of the video-processing thread: the framesets are loaded into memory first,
+// then driven through post_processing_chain as fast as it goes, once per resolution and decimation level.
+// The full-resolution depth frames are also deprojected into organized point clouds, by rs2::pointcloud and
+// by ray_table, to compare the two.
+//
+//   FilterBenchmark [--playback <file.bag> | --synthetic-modes 640x480@60,848x480@60,1280x720@30]
+//                   [--decimation 1,2,3,4] [--frames 150] [--passes 3] [--align color|depth]
+
+// Every heap allocation made through operator new in this process.
+// librealsense allocations are only included where the SDK shares the executable's operator new
+// (shared libraries on Linux), a Windows DLL allocates from its own CRT heap
+static std::atomic<unsigned long long> allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// Frames left out of the measurement at the start of every run, lets the filters reach a steady state
+const size_t WARMUP_FRAMES = 10;
+
+struct run_result
+{
+    double frames_per_second = 0;
+    double ms_per_frame = 0;
+    double allocations_per_frame = 0;
+    std::vector<std::string> step_names;
+    std::vector<double> step_ms;          // per frame
+    std::vector<double> step_allocations; // per frame
+};
+
+// Runs every frameset through a fresh chain passes times, timing each step separately
+run_result run_chain(const std::vector<rs2::frameset>& frames, rs2_stream align_to, int magnitude, int passes)
+{
+    post_processing_chain chain(align_to);
+    chain.decimation.set_magnitude(magnitude);
+
+    run_result result;
+    for (size_t i = 0; i < chain.size(); i++)
+        result.step_names.push_back(chain.step_name(i));
+    result.step_ms.assign(chain.size(), 0.0);
+    result.step_allocations.assign(chain.size(), 0.0);
+
+    size_t warmup = std::min(WARMUP_FRAMES, frames.size() / 2);
+    for (size_t f = 0; f < warmup; f++)
+    {
+        rs2::frameset data = frames[f];
+        for (size_t i = 0; i < chain.size(); i++)
+            data = chain.apply_step(i, data);
+    }
+
+    size_t processed = 0;
+    auto allocations_start = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (auto& frame : frames)
+        {
+            rs2::frameset data = frame;
+            for (size_t i = 0; i < chain.size(); i++)
+            {
+                auto step_allocations = allocations.load(std::memory_order_relaxed);
+                auto step_start = std::chrono::steady_clock::now();
+                data = chain.apply_step(i, data);
+                result.step_ms[i] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - step_start).count();
+                result.step_allocations[i] += double(allocations.load(std::memory_order_relaxed) - step_allocations);
+            }
+            processed++;
+        }
+    }
+    auto total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    result.ms_per_frame = total_ms / processed;
+    result.frames_per_second = 1000.0 / result.ms_per_frame;
+    result.allocations_per_frame = double(allocations.load() - allocations_start) / processed;
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        result.step_ms[i] /= processed;
+        result.step_allocations[i] /= processed;
+    }
+    return result;
+}
+
+// ms per frame to deproject every depth frame into a point cloud with rs2::pointcloud, then with ray_table
+void run_deprojection(const std::vector<rs2::frameset>& frames, int passes, double& pointcloud_ms, double& ray_table_ms)
+{
+    rs2::pointcloud pc;
+    ray_table rays;
+    std::vector<float> points;
+    for (auto& frame : frames) // warm-up, the table and the buffer
+    {
+        auto depth = frame.get_depth_frame();
+        pc.calculate(depth);
+        rays.update(depth);
+        points.resize(size_t(depth.get_width()) * depth.get_height() * 3);
+    }
+
+    size_t processed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (auto& frame : frames)
+        {
+            pc.calculate(frame.get_depth_frame());
+            processed++;
+        }
+    }
+    pointcloud_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / processed;
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (auto& frame : frames)
+        {
+            auto depth = frame.get_depth_frame();
+            rays.update(depth);
+            rays.deproject(depth, points.data());
+        }
+    }
+    ray_table_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / processed;
+}
+
+void print_result(const std::string& input, int magnitude, const run_result& r)
+{
+    std::cout << std::left << std::setw(22) << input << std::right
+        << std::setw(6) << (magnitude > 1 ? std::to_string(magnitude) : std::string("off"))
+        << std::fixed << std::setprecision(1) << std::setw(10) << r.frames_per_second
+        << std::setprecision(2) << std::setw(10) << r.ms_per_frame
+        << std::setprecision(1) << std::setw(10) << r.allocations_per_frame << std::endl;
+    for (size_t i = 0; i < r.step_names.size(); i++)
+    {
+        std::cout << "    " << std::left << std::setw(12) << r.step_names[i] << std::right
+            << std::setprecision(2) << std::setw(8) << r.step_ms[i] << " ms"
+            << std::setprecision(1) << std::setw(8) << r.step_allocations[i] << " allocs" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) try
+{
+    size_t frame_count = 150;
+    if (auto value = flag_value(argc, argv, "--frames"))
+        frame_count = size_t(std::max(1, std::atoi(value)));
+    int passes = 3;
+    if (auto value = flag_value(argc, argv, "--passes"))
+        passes = std::max(1, std::atoi(value));
+    std::vector<int> magnitudes = { 1, 2, 3, 4 };
+    if (auto value = flag_value(argc, argv, "--decimation"))
+    {
+        magnitudes.clear();
+        for (auto& m : split_list(value))
+            magnitudes.push_back(std::atoi(m.c_str()));
+    }
+    // BlobTracker aligns to color, RealHelloXY to depth
+    auto align_value = flag_value(argc, argv, "--align");
+    rs2_stream align_to = align_value && std::string(align_value) == "depth" ? RS2_STREAM_DEPTH : RS2_STREAM_COLOR;
+
+    // A recording is benchmarked at the resolution it was captured with, synthetic frames at every listed mode
+    std::vector<source_options> inputs;
+    std::vector<std::string> input_names;
+    if (auto file = flag_value(argc, argv, "--playback"))
+    {
+        source_options opts;
+        opts.playback_file = file;
+        inputs.push_back(opts);
+        input_names.push_back(file);
+    }
+    else
+    {
+        auto modes = flag_value(argc, argv, "--synthetic-modes");
+        for (auto& mode : split_list(modes ? modes : "640x480@60,848x480@60,1280x720@30"))
+        {
+            source_options opts;
+            opts.synthetic = true;
+            if (!parse_synthetic_mode(mode.c_str(), opts.scene))
+                throw std::runtime_error("--synthetic-modes expects WIDTHxHEIGHT@FPS[,...], e.g. 848x480@90");
+            inputs.push_back(opts);
+            input_names.push_back("synthetic " + std::to_string(opts.scene.width) + "x" + std::to_string(opts.scene.height));
+        }
+    }
+
+    std::cout << "Filter chain benchmark, aligned to " << (align_to == RS2_STREAM_DEPTH ? "depth" : "color")
+        << ", " << passes << " passes over the loaded frames" << std::endl;
+    std::cout << std::left << std::setw(22) << "input" << std::right << std::setw(6) << "dec"
+        << std::setw(10) << "frames/s" << std::setw(10) << "ms/frame" << std::setw(10) << "allocs" << std::endl;
+
+    for (size_t n = 0; n < inputs.size(); n++)
+    {
+        auto frames = load_framesets(inputs[n], frame_count);
+        auto name = input_names[n] + " (" + std::to_string(frames.size()) + ")";
+        for (auto m : magnitudes)
+            print_result(name, m, run_chain(frames, align_to, m, passes));
+        double pointcloud_ms, ray_table_ms;
+        run_deprojection(frames, passes, pointcloud_ms, ray_table_ms);
+        std::cout << "    deprojection: rs2::pointcloud " << std::setprecision(2) << pointcloud_ms
+            << " ms/frame, ray_table " << ray_table_ms << " ms/frame" << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error& e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
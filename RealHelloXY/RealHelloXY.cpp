@@ -3,6 +3,13 @@
 
 #include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
 #include "example.hpp"          // Include short list of convenience functions for rendering
+#include "frame-acquisition.hpp" // Blocking frame acquisition and processing-thread load measurement
+#include "latest-mailbox.hpp"    // Latest-wins frame handoff between threads
+#include "filter-chain.hpp"      // Depth post-processing chain, sequential or pipelined
+#include "trace-export.hpp"      // Chrome trace / Perfetto export of pipeline spans
+#include "gl-renderer.hpp"       // Shader-based drawing of images and overlays
+#include "headless-run.hpp"      // Config files, result files and stop conditions of unattended runs
+#include "ray-table.hpp"         // Per-pixel rays for deprojection without the distortion model
 
 // This example will require several standard data-structures and algorithms:
 #define _USE_MATH_DEFINES
@@ -13,6 +20,8 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <memory>
+#include <sstream>
 
 using pixel = std::pair<int, int>;
 
@@ -27,123 +36,212 @@ struct state {
 // Helper function to register to UI events
 void register_glfw_callbacks(window& app, state& app_state);
 
+// 3D point at a color pixel (full resolution, depth may be decimated), false without valid depth there
+bool measure_point(const rs2::depth_frame& depth, const rs2::video_frame& color, ray_table& rays, const pixel& p, float point[3]);
+
 int main(int argc, char* argv[]) try
 {
+    // Pass --config <file> to read any of the flags below from a key = value file as well
+    run_config config(argc, argv);
+    argc = config.argc();
+    argv = config.argv();
+
+    // Pass --batch to measure without a window (no textures, no colorizer): every frame, the 3D point at each of
+    // --points X,Y;X,Y;... is written to --output (JSON Lines on stdout by default). The run ends with the
+    // recording, after --duration <s> or on Ctrl+C
+    bool batch = has_flag(argc, argv, "--batch");
+    std::vector<pixel> batch_points;
+    if (auto points = flag_value(argc, argv, "--points"))
+    {
+        std::stringstream list(points);
+        std::string item;
+        while (std::getline(list, item, ';'))
+        {
+            pixel p;
+            if (!parse_pixel(item.c_str(), p))
+                throw std::runtime_error("--points expects X,Y;X,Y;..., e.g. 640,360;100,200");
+            batch_points.push_back(p);
+        }
+    }
+    if (batch && batch_points.empty())
+        throw std::runtime_error("A batch run needs the pixels to measure: --points X,Y;X,Y;...");
+
+    // Pass --playback <file.bag> to run on a recording instead of a live camera,
+    // or --synthetic WxH@fps to run on a rendered scene without any hardware
+    source_options source_opts = parse_source_options(argc, argv);
+
     std::string serial;
-    if (!device_with_streams({ RS2_STREAM_COLOR,RS2_STREAM_DEPTH }, serial))
+    if (source_opts.live() && !device_with_streams({ RS2_STREAM_COLOR,RS2_STREAM_DEPTH }, serial))
         return EXIT_SUCCESS;
 
     // OpenGL textures for the color and depth frames
     texture depth_image, color_image;
 
-    // Colorizer is used to visualize depth data
-    rs2::colorizer color_map;
-    // Use black to white color map
-    color_map.set_option(RS2_OPTION_COLOR_SCHEME, 2.f);
-    // Decimation filter reduces the amount of data (while preserving best samples)
-    rs2::decimation_filter dec;
-    // If the demo is too slow, make sure you run in Release (-DCMAKE_BUILD_TYPE=Release)
-    // but you can also increase the following parameter to decimate depth more (reducing quality)
-    dec.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2);
-    // Define transformations from and to Disparity domain
-    rs2::disparity_transform depth2disparity;
-    rs2::disparity_transform disparity2depth(false);
-    // Define spatial filter (edge-preserving)
-    rs2::spatial_filter spat;
-    // Enable hole-filling
-    // Hole filling is an agressive heuristic and it gets the depth wrong many times
-    // However, this demo is not built to handle holes
-    // (the shortest-path will always prefer to "cut" through the holes since they have zero 3D distance)
-    spat.set_option(RS2_OPTION_HOLES_FILL, 5); // 5 = fill all the zero pixels
-    // Define temporal filter
-    rs2::temporal_filter temp;
-    // Spatially align all streams to depth viewport
-    // We do this because:
-    //   a. Usually depth has wider FOV, and we only really need depth for this demo
-    //   b. We don't want to introduce new holes
-    rs2::align align_to(RS2_STREAM_DEPTH);
-
-    // Declare RealSense pipeline, encapsulating the actual device and sensors
-    rs2::pipeline pipe;
-
-    rs2::config cfg;
-    if (!serial.empty())
-        cfg.enable_device(serial);
-
-    cfg.enable_stream(RS2_STREAM_DEPTH, 1280, 720, RS2_FORMAT_Z16, 30);
-    cfg.enable_stream(RS2_STREAM_COLOR, 1280, 720, RS2_FORMAT_RGBA8, 30);
-    cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
-
-    auto profile = pipe.start(cfg);
-
-    auto sensor = profile.get_device().first<rs2::depth_sensor>();
+    // Depth post-processing (align, disparity, spatial, temporal, colorizer unless in batch mode).
+    // Streams are aligned to the depth viewport, we only really need depth for this demo
+    // and we don't want to introduce new holes
+    post_processing_chain processing(RS2_STREAM_DEPTH, !batch);
+    // Pass --budget <ms> to let the chain decimate depth whenever processing takes longer than that
+    if (auto budget = flag_value(argc, argv, "--budget"))
+        processing.decimation.set_budget(std::atof(budget));
+
+    // Declare RealSense pipeline, encapsulating the actual device and sensors (or a recording, or the synthetic scene)
+    frame_source source(source_opts);
+
+    source.start([&](rs2::config& cfg) {
+        if (!serial.empty())
+            cfg.enable_device(serial);
+
+        cfg.enable_stream(RS2_STREAM_DEPTH, 1280, 720, RS2_FORMAT_Z16, 30);
+        cfg.enable_stream(RS2_STREAM_COLOR, 1280, 720, RS2_FORMAT_RGBA8, 30);
+        cfg.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
+        });
+
+    auto sensor = source.get_device().first<rs2::depth_sensor>();
 
     // Set the device to High Accuracy preset of the D400 stereoscopic cameras
-    if (sensor && sensor.is<rs2::depth_stereo_sensor>())
+    // (a recording replays the settings it was captured with)
+    if (source.is_live() && sensor && sensor.is<rs2::depth_stereo_sensor>())
     {
         sensor.set_option(RS2_OPTION_VISUAL_PRESET, RS2_RS400_VISUAL_PRESET_HIGH_ACCURACY);
     }
 
-    auto stream = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
-
-    // Create a simple OpenGL window for rendering:
-    window app(stream.width(), stream.height(), "RealHelloXYZ");
+    auto stream = source.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
 
     state app_state;
 
-    register_glfw_callbacks(app, app_state);
+    // Create a simple OpenGL window for rendering (none in batch mode)
+    std::unique_ptr<window> app_window;
+    // Images, axes and text, batched into a few draw calls per frame
+    std::unique_ptr<gl_renderer> overlay;
+    if (!batch)
+    {
+        app_window.reset(new window(stream.width(), stream.height(), "RealHelloXYZ"));
+        overlay.reset(new gl_renderer());
+        register_glfw_callbacks(*app_window, app_state);
+    }
+
+    // Pass --output <file.csv | file.jsonl | -> for the batch measurements (the reports then go to stderr on stdout)
+    std::unique_ptr<result_sink> results;
+    if (batch)
+    {
+        auto output = flag_value(argc, argv, "--output");
+        results.reset(new result_sink(output ? output : "-"));
+    }
+    std::ostream& reports = results && results->to_stdout() ? std::cerr : std::cout;
 
-    rs2::frame_queue postprocessed_frames;
+    // Newest processed frameset, older ones are dropped (and counted) if the main loop falls behind
+    latest_mailbox<rs2::frameset> postprocessed_frames;
 
     std::atomic_bool alive{ true };
 
+    // Send resulting frames for visualization in the main thread. When a recording is replayed
+    // in lockstep wait until the frameset has been picked up, so that no frame is skipped
+    std::atomic_bool source_done{ false };
+    // Pass --trace <file.json> to record every stage of every frame, to open in ui.perfetto.dev or chrome://tracing
+    auto tracer = trace_from_command_line(argc, argv);
+    if (tracer)
+        processing.on_step_done([&](size_t step, const rs2::frameset& data, std::chrono::steady_clock::time_point start) {
+            tracer->span(processing.step_name(step).c_str(), latency_stats::frame_key(data), monotonic_us(start), monotonic_us());
+            });
+    auto publish_frames = [&](const rs2::frameset& data) {
+        trace_span span(tracer.get(), "publish", latency_stats::frame_key(data));
+        postprocessed_frames.publish(data);
+        if (source.lockstep())
+            while (alive && !postprocessed_frames.wait_taken(std::chrono::milliseconds(ACQUISITION_TIMEOUT_MS))) {}
+    };
+
+    // Pass --poll to fall back to the old busy-polling loop (for comparing CPU load and latency)
+    bool busy_poll = has_flag(argc, argv, "--poll");
+
+    // Pass --pipelined to run the post-processing steps on one worker thread per stage:
+    // align + decimation | disparity + spatial | temporal + depth | colorizer
+    std::unique_ptr<pipelined_chain> pipelined_processing;
+    if (has_flag(argc, argv, "--pipelined"))
+        pipelined_processing.reset(new pipelined_chain(processing, { 2, 2, 2, 1 }, publish_frames));
+
     // Video-processing thread will fetch frames from the camera,
     // apply post-processing and send the result to the main thread for rendering
     // It recieves synchronized (but not spatially aligned) pairs
     // and outputs synchronized and aligned pairs
     std::thread video_processing_thread([&]() {
+        acquisition_meter meter(busy_poll ? "Processing thread (polling)" : "Processing thread (blocking)");
+        if (tracer) tracer->name_thread("video processing");
         while (alive)
         {
-            // Fetch frames from the pipeline and send them for processing
+            // Fetch frames from the pipeline and send them for processing.
+            // Block until the next frameset arrives (or the timeout expires so that alive is re-checked)
+            // instead of spinning on poll_for_frames
             rs2::frameset data;
-            if (pipe.poll_for_frames(&data))
+            if (busy_poll ? source.poll(data) : source.wait(data))
             {
-                // First make the frames spatially aligned
-                data = data.apply_filter(align_to);
-
-                // Decimation will reduce the resultion of the depth image,
-                // closing small holes and speeding-up the algorithm
-                //data = data.apply_filter(dec);
-
-                // To make sure far-away objects are filtered proportionally
-                // we try to switch to disparity domain
-                data = data.apply_filter(depth2disparity);
-
-                // Apply spatial filtering
-                data = data.apply_filter(spat);
-
-                // Apply temporal filtering
-                data = data.apply_filter(temp);
-
-                // If we are in disparity domain, switch back to depth
-                data = data.apply_filter(disparity2depth);
-
-                //// Apply color map for visualization of depth
-                data = data.apply_filter(color_map);
-
-                // Send resulting frames for visualization in the main thread
-                postprocessed_frames.enqueue(data);
+                if (pipelined_processing)
+                {
+                    // Hand the frameset to the first stage, the last stage publishes the result
+                    pipelined_processing->push(data);
+                }
+                else
+                {
+                    data = processing.process(data);
+                    publish_frames(data);
+                }
+                meter.frame_done(data);
+            }
+            else if (source.finished())
+            {
+                // End of the recording, flush the frames still in the pipeline and let the main loop exit
+                if (pipelined_processing)
+                    pipelined_processing->finish();
+                source_done = true;
+                break;
             }
         }
+        meter.report(reports);
         });
 
     rs2::frameset current_frameset;
+    unsigned long long current_sequence = 0;
+    if (tracer) tracer->name_thread("render");
+    long long swap_begin_us = -1;
+    // Rays of the depth stream, rebuilt only when its intrinsics change (decimation)
+    ray_table depth_rays;
+
+    // Batch: every processed frameset is measured, nothing is drawn
+    run_limit limit(argc, argv);
+    while (batch && !limit.reached())
+    {
+        if (!postprocessed_frames.wait_take(current_frameset, &current_sequence, std::chrono::milliseconds(ACQUISITION_TIMEOUT_MS)))
+        {
+            if (source_done) break;
+            continue;
+        }
+        auto depth = current_frameset.get_depth_frame();
+        auto color = current_frameset.get_color_frame();
+        for (size_t i = 0; i < batch_points.size(); i++)
+        {
+            float point[3] = { 0, 0, 0 };
+            bool valid = measure_point(depth, color, depth_rays, batch_points[i], point);
+            results->field("frame", color.get_frame_number())
+                .field("timestamp", color.get_timestamp())
+                .field("point", int(i))
+                .field("u", batch_points[i].first).field("v", batch_points[i].second)
+                .field("valid", valid)
+                .field("x", point[0]).field("y", point[1]).field("z", point[2]);
+            results->end_record();
+        }
+    }
 
-    while (app) // Application still alive?
+    while (app_window && *app_window && !source_done && !limit.reached()) // Application still alive?
     {
-        // Fetch the latest available post-processed frameset
+        auto& app = *app_window;
+        // window::operator bool swapped the buffers and polled the events
+        if (tracer && swap_begin_us >= 0)
+            tracer->span("swap buffers", trace_recorder::NO_FRAME, swap_begin_us, monotonic_us());
+        trace_span render_span(tracer.get(), "render");
 
-        postprocessed_frames.poll_for_frame(&current_frameset);
+        // Fetch the latest available post-processed frameset,
+        // keep showing the previous one until a newer frameset arrives
+        postprocessed_frames.try_take(current_frameset, &current_sequence);
 
         if (current_frameset)
         {
@@ -152,7 +250,10 @@ int main(int argc, char* argv[]) try
             auto colorized_depth = current_frameset.first(RS2_STREAM_DEPTH, RS2_FORMAT_RGB8);
             auto accel_frame = current_frameset.first_or_default(RS2_STREAM_ACCEL);
 
-            rs2_vector accel_data = accel_frame.as<rs2::motion_frame>().get_motion_data();
+            // Recordings may not contain the motion stream
+            rs2_vector accel_data = { 0, 0, 0 };
+            if (auto motion = accel_frame.as<rs2::motion_frame>())
+                accel_data = motion.get_motion_data();
             // Calculate pitch and roll in radians
             float yaw = atan2(-accel_data.x, sqrt(accel_data.y * accel_data.y + accel_data.z * accel_data.z));
             float roll = atan2(accel_data.y, accel_data.z);
@@ -168,15 +269,8 @@ int main(int argc, char* argv[]) try
             }
             if (app_state.new_click)
             {
-                float pixel[2] = { float(app_state.last_click.first), float(app_state.last_click.second) };
                 float point[3];
-                auto intr = depth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
-                // Get distance at pixel coordinates
-                float distance = depth.get_distance(app_state.last_click.first, app_state.last_click.second);
-
-                if (distance > 0) {
-                    rs2_deproject_pixel_to_point(point, &intr, pixel, distance);
-
+                if (measure_point(depth, color, depth_rays, app_state.last_click, point)) {
                     std::cout << "2D [" << app_state.last_click.first << ", " << app_state.last_click.second << "], ";
                     std::cout << std::fixed << std::setprecision(4) << "3D [" << point[0] << ", " << point[1] << ", " << point[2] << "]";
                     // Calculate the distance from the current point to the last point
@@ -202,52 +296,66 @@ int main(int argc, char* argv[]) try
             }
 
 
-            glEnable(GL_BLEND);
-            // Use the Alpha channel for blending
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            overlay->begin(app.width(), app.height());
 
             // First render the colorized depth image
-            depth_image.render(colorized_depth, { 0, 0, app.width(), app.height() });
+            depth_image.render(*overlay, colorized_depth, { 0, 0, app.width(), app.height() });
 
             // Render the color frame (since we have selected RGBA format
             // pixels out of FOV will appear transparent)
-            color_image.render(color, { 0, 0, app.width(), app.height() });
-
-            // Show stream resolutions
-            std::string depth_res = "Depth: " + std::to_string(depth.get_width()) + "x" + std::to_string(depth.get_height());
-            std::string color_res = "Color: " + std::to_string(color.get_width()) + "x" + std::to_string(color.get_height());
-            std::string str_roll = "Roll: " + std::to_string(roll_deg);
-            std::string str_yaw = "Yaw: " + std::to_string(yaw_deg);
-
-            glColor3f(1.f, 1.f, 1.f);
-            draw_text(10, 10, depth_res.c_str());
-            draw_text(10, 20, color_res.c_str());
-            glColor3f(1.f, 0.f, 1.f);
-            draw_text(10, 40, str_roll.c_str());
-            glColor3f(0.f, 1.f, 1.f);
-            draw_text(10, 50, str_yaw.c_str());
-
-            // Draw intersecting lines
-            glLineWidth(1.0f); // Set line width
-            glBegin(GL_LINES);
-            // Y axis
-            glColor3f(0.0f, 1.0f, 0.0f);
-            glVertex2f(app.width() / 2.0f, 0.0f);
-            glVertex2f(app.width() / 2.0f, app.height());
-            // X axis
-            glColor3f(1.0f, 0.0f, 0.0f);
-            glVertex2f(0.0f, app.height() / 2.0f);
-            glVertex2f(app.width(), app.height() / 2.0f);
-            glEnd();
-
-            glColor3f(1.f, 1.f, 1.f);
-            glDisable(GL_BLEND);
+            color_image.render(*overlay, color, { 0, 0, app.width(), app.height() });
+
+            // Intersecting lines through the center, Y axis then X axis
+            overlay->line(app.width() / 2.0f, 0.0f, app.width() / 2.0f, app.height(), 1.0f, { 0.0f, 1.0f, 0.0f, 1.0f });
+            overlay->line(0.0f, app.height() / 2.0f, app.width(), app.height() / 2.0f, 1.0f, { 1.0f, 0.0f, 0.0f, 1.0f });
+
+            // Show stream resolutions (formatted in place, nothing is allocated per frame)
+            fixed_text<64> depth_res, color_res, frames_info, str_roll, str_yaw;
+            depth_res.format("Depth: %dx%d", depth.get_width(), depth.get_height());
+            if (processing.decimation.magnitude() > 1)
+                depth_res.append(" (decimated x%d)", processing.decimation.magnitude());
+            color_res.format("Color: %dx%d", color.get_width(), color.get_height());
+            frames_info.format("Frame #%llu, dropped: %llu", current_sequence, postprocessed_frames.dropped());
+            str_roll.format("Roll: %f", roll_deg);
+            str_yaw.format("Yaw: %f", yaw_deg);
+
+            const gl_renderer::color white = { 1.f, 1.f, 1.f, 1.f };
+            overlay->text(10, 10, depth_res.c_str(), white);
+            overlay->text(10, 20, color_res.c_str(), white);
+            overlay->text(10, 30, frames_info.c_str(), white);
+            overlay->text(10, 40, str_roll.c_str(), { 1.f, 0.f, 1.f, 1.f });
+            overlay->text(10, 50, str_yaw.c_str(), { 0.f, 1.f, 1.f, 1.f });
+
+            // Three draw calls: the two images, then the lines and every label at once
+            overlay->flush();
         }
+        render_span.end();
+        swap_begin_us = monotonic_us();
     }
 
     // Signal threads to finish and wait until they do
     alive = false;
     video_processing_thread.join();
+    if (pipelined_processing)
+    {
+        pipelined_processing->stop();
+        pipelined_processing->report(reports);
+    }
+    processing.report(reports);
+
+    reports << "Processed framesets: " << postprocessed_frames.published()
+        << (batch ? ", measured: " : ", displayed: ") << postprocessed_frames.consumed()
+        << ", dropped: " << postprocessed_frames.dropped() << std::endl;
+    if (results)
+    {
+        results->flush();
+        results->report(reports);
+    }
+    if (tracer)
+    {
+        tracer->close();
+        tracer->report(reports);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -282,3 +390,19 @@ void register_glfw_callbacks(window& app, state& app_state)
         };
 }
 
+bool measure_point(const rs2::depth_frame& depth, const rs2::video_frame& color, ray_table& rays, const pixel& p, float point[3])
+{
+    // Depth may be decimated, scale the (full resolution) pixel to depth pixels
+    float depth_scale_x = float(depth.get_width()) / color.get_width();
+    float depth_scale_y = float(depth.get_height()) / color.get_height();
+    float pixel[2] = { p.first * depth_scale_x, p.second * depth_scale_y };
+    if (pixel[0] < 0 || pixel[1] < 0 || int(pixel[0]) >= depth.get_width() || int(pixel[1]) >= depth.get_height())
+        return false;
+    rays.update(depth);
+    // Get distance at pixel coordinates
+    float distance = depth.get_distance(int(pixel[0]), int(pixel[1]));
+    if (distance <= 0)
+        return false;
+    rays.deproject(pixel, distance, point);
+    return true;
+}
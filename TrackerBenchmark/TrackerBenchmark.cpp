@@ -0,0 +1,251 @@
+#include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
+#include "frame-acquisition.hpp" // Recordings and synthetic frames
+#include "color-mask.hpp"        // RGB -> Lab box classification lookup table
+#include "blob-detection.hpp"    // Single-pass blob extraction on binary masks
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/features2d.hpp>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+// Microbenchmarks of every step of the BlobTracker tracking loop, run over a corpus of RGB8 color frames.
+// Each step is timed on its own, on inputs precomputed by the previous steps, and the replacements in use
+// (lab_box_lut, rect_dilation, binary_blob_detector) are timed next to the OpenCV calls they replaced.
+// Blob detection is broken down by the number of blobs in the frame: extra disks of the tracked color are
+// drawn into copies of the corpus, on top of whatever the frames already contain.
+//
+//   TrackerBenchmark [--playback <file.bag> [--click X,Y] | --synthetic WxH@fps] [--frames 60]
+//                    [--dilate 0,2,5,10] [--blobs 1,4,16] [--min-time 0.5] [--filter <substring>]
+
+// BlobTracker's defaults
+const int THRESHOLD_LAB_L = 50;
+const int THRESHOLD_LAB_AB = 15;
+
+cv::SimpleBlobDetector::Params tracker_blob_params()
+{
+    cv::SimpleBlobDetector::Params params;
+    params.minThreshold = 0.0f;
+    params.maxThreshold = 100.0f;
+    params.filterByArea = true;
+    params.minArea = 300;
+    params.maxArea = 600000;
+    params.filterByCircularity = true;
+    params.minCircularity = 0.5f;
+    params.maxCircularity = 1.0f;
+    params.filterByConvexity = true;
+    params.minConvexity = 0.7f;
+    params.maxConvexity = 1.0f;
+    params.filterByInertia = true;
+    params.minInertiaRatio = 0.6f;
+    params.maxInertiaRatio = 1.0f;
+    return params;
+}
+
+/// \brief Runs a step over the corpus until it has taken at least min_time, then prints the time per
+/// call like Google Benchmark does (wall and CPU time of this thread, iterations)
+class benchmark_runner
+{
+public:
+    benchmark_runner(double min_time_s, const char* filter) : _min_time_s(min_time_s), _filter(filter ? filter : "")
+    {
+        std::cout << std::left << std::setw(40) << "Benchmark" << std::right << std::setw(14) << "Time"
+            << std::setw(14) << "CPU" << std::setw(12) << "Iterations" << std::endl;
+        std::cout << std::string(80, '-') << std::endl;
+    }
+
+    // body(i) processes corpus item i, called for i = 0, 1, ... items - 1, 0, 1, ...
+    template<class F>
+    void run(const std::string& name, size_t items, F body)
+    {
+        if (!_filter.empty() && name.find(_filter) == std::string::npos)
+            return;
+
+        body(0); // warm-up, buffers and caches
+        size_t iterations = 0;
+        auto cpu_start = thread_cpu_time_ms();
+        auto start = std::chrono::steady_clock::now();
+        double elapsed_s = 0;
+        do
+        {
+            body(iterations % items);
+            iterations++;
+            // the clock is only read after whole passes over the corpus
+            if (iterations % items == 0)
+                elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed_s < _min_time_s);
+        auto cpu_ms = thread_cpu_time_ms() - cpu_start;
+
+        std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(14) << format(elapsed_s * 1000.0 / iterations)
+            << std::setw(14) << format(cpu_ms / iterations)
+            << std::setw(12) << iterations << std::endl;
+    }
+
+private:
+    static std::string format(double ms)
+    {
+        char text[32];
+        if (ms >= 1.0) std::snprintf(text, sizeof(text), "%.2f ms", ms);
+        else std::snprintf(text, sizeof(text), "%.1f us", ms * 1000.0);
+        return text;
+    }
+
+    double _min_time_s;
+    std::string _filter;
+};
+
+// Draws disks of the given color on a regular grid, as many as fit up to count
+void add_blobs(cv::Mat& rgb, int count, const cv::Vec3b& color)
+{
+    int radius = std::max(12, rgb.cols / 40);
+    int columns = 1;
+    while (columns * columns < count) columns++;
+    for (int i = 0; i < count; i++)
+    {
+        cv::Point center((2 * (i % columns) + 1) * rgb.cols / (2 * columns), (2 * (i / columns) + 1) * rgb.rows / (2 * columns));
+        cv::circle(rgb, center, radius, cv::Scalar(color[0], color[1], color[2]), cv::FILLED);
+    }
+}
+
+std::vector<int> int_list(const char* value, std::vector<int> defaults)
+{
+    if (!value) return defaults;
+    std::vector<int> values;
+    for (auto& item : split_list(value))
+        values.push_back(std::atoi(item.c_str()));
+    return values;
+}
+
+int main(int argc, char* argv[]) try
+{
+    // Corpus: a recording (tracked color picked at --click, the frame center by default) or the synthetic scene
+    source_options opts = parse_source_options(argc, argv);
+    if (!opts.playback() && !opts.synthetic)
+    {
+        opts.synthetic = true;
+        parse_synthetic_mode("1280x720@30", opts.scene);
+    }
+    size_t frame_count = 60;
+    if (auto value = flag_value(argc, argv, "--frames"))
+        frame_count = size_t(std::max(1, std::atoi(value)));
+    auto dilate_sizes = int_list(flag_value(argc, argv, "--dilate"), { 0, 2, 5, 10 });
+    auto blob_counts = int_list(flag_value(argc, argv, "--blobs"), { 1, 4, 16 });
+    double min_time_s = 0.5;
+    if (auto value = flag_value(argc, argv, "--min-time"))
+        min_time_s = std::atof(value);
+
+    std::vector<cv::Mat> corpus;
+    for (auto& frames : load_framesets(opts, frame_count))
+    {
+        auto color = frames.get_color_frame();
+        if (!color || color.get_profile().format() != RS2_FORMAT_RGB8)
+            throw std::runtime_error("The corpus needs an RGB8 color stream");
+        corpus.push_back(cv::Mat(cv::Size(color.get_width(), color.get_height()), CV_8UC3, (void*)color.get_data(), cv::Mat::AUTO_STEP).clone());
+    }
+    const size_t n = corpus.size();
+    const cv::Size size = corpus[0].size();
+
+    cv::Vec3b track_rgb;
+    if (opts.synthetic)
+        track_rgb = cv::Vec3b(opts.scene.sphere_color[0], opts.scene.sphere_color[1], opts.scene.sphere_color[2]);
+    else
+    {
+        int x = size.width / 2, y = size.height / 2;
+        if (auto click = flag_value(argc, argv, "--click"))
+            std::sscanf(click, "%d,%d", &x, &y);
+        track_rgb = corpus[0].at<cv::Vec3b>(std::min(std::max(y, 0), size.height - 1), std::min(std::max(x, 0), size.width - 1));
+    }
+    auto track_lab = rgb_to_lab(track_rgb);
+    cv::Scalar lab_min(track_lab[0] - THRESHOLD_LAB_L, track_lab[1] - THRESHOLD_LAB_AB, track_lab[2] - THRESHOLD_LAB_AB);
+    cv::Scalar lab_max(track_lab[0] + THRESHOLD_LAB_L, track_lab[1] + THRESHOLD_LAB_AB, track_lab[2] + THRESHOLD_LAB_AB);
+
+    std::cout << "Corpus: " << n << " frames of " << size.width << "x" << size.height
+        << (opts.synthetic ? " (synthetic)" : " from " + opts.playback_file) << std::endl << std::endl;
+
+    benchmark_runner bench(min_time_s, flag_value(argc, argv, "--filter"));
+    const std::string res = "/" + std::to_string(size.width) + "x" + std::to_string(size.height);
+
+    // Color classification, the original two-pass path and the lookup table
+    std::vector<cv::Mat> lab(n), mask(n);
+    for (size_t i = 0; i < n; i++)
+        cv::cvtColor(corpus[i], lab[i], cv::COLOR_RGB2Lab);
+    cv::Mat out;
+    bench.run("cvtColor RGB2Lab" + res, n, [&](size_t i) { cv::cvtColor(corpus[i], out, cv::COLOR_RGB2Lab); });
+    bench.run("inRange" + res, n, [&](size_t i) { cv::inRange(lab[i], lab_min, lab_max, out); });
+    lab_box_lut table;
+    // alternates between two boxes, so that every call rebuilds the table (what a click or a slider costs)
+    bool other_box = false;
+    bench.run("lab_box_lut::update", 1, [&](size_t) {
+        other_box = !other_box;
+        table.update(lab_min, other_box ? lab_max + cv::Scalar(1, 1, 1) : lab_max);
+    });
+    table.update(lab_min, lab_max);
+    bench.run("lab_box_lut::apply" + res, n, [&](size_t i) { table.apply(corpus[i], out); });
+    for (size_t i = 0; i < n; i++)
+        table.apply(corpus[i], mask[i]);
+
+    // Dilation, structuring element included as in the original tracking loop, then the fused replacement
+    for (auto d : dilate_sizes)
+    {
+        bench.run("getStructuringElement+dilate/" + std::to_string(d), n, [&](size_t i) {
+            cv::Mat element = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * d + 1, 2 * d + 1), cv::Point(d, d));
+            cv::dilate(mask[i], out, element);
+        });
+    }
+    bench.run("invert (255 - mask)" + res, n, [&](size_t i) { out = 255 - mask[i]; });
+    rect_dilation dilation;
+    for (auto d : dilate_sizes)
+        bench.run("rect_dilation::apply+invert/" + std::to_string(d), n, [&](size_t i) { dilation.apply(mask[i], out, d, true); });
+
+    // Detection and blob association by number of blobs in the frame
+    auto params = tracker_blob_params();
+    auto simple_detector = cv::SimpleBlobDetector::create(params);
+    binary_blob_detector extractor(params);
+    const int dilate_size = 2;
+    for (auto blobs : blob_counts)
+    {
+        // inverted dilated masks with blobs - 1 extra disks, the tracked object makes the last one
+        std::vector<cv::Mat> masks(n);
+        std::vector<std::vector<cv::KeyPoint>> keypoints(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            cv::Mat rgb = corpus[i].clone();
+            add_blobs(rgb, blobs - 1, track_rgb);
+            table.apply(rgb, masks[i]);
+            dilation.apply(masks[i], masks[i], dilate_size, true);
+            extractor.detect(masks[i], keypoints[i]);
+        }
+
+        const std::string suffix = "/blobs:" + std::to_string(blobs);
+        std::vector<cv::KeyPoint> found;
+        bench.run("SimpleBlobDetector::detect" + suffix, n, [&](size_t i) { simple_detector->detect(masks[i], found); });
+        bench.run("binary_blob_detector::detect" + suffix, n, [&](size_t i) { extractor.detect(masks[i], found); });
+        std::pair<int, int> center(size.width / 2, size.height / 2);
+        bench.run("findClosestKeypoint" + suffix, n, [&](size_t i) {
+            if (!keypoints[i].empty())
+                found.assign(1, findClosestKeypoint(keypoints[i], center, INT_MAX));
+        });
+    }
+
+    return EXIT_SUCCESS;
+}
+catch (const rs2::error& e)
+{
+    std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/features2d.hpp>
+
+#include <vector>
+#include <utility>
+#include <limits>
+#include <stdexcept>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+//////////////////////////////
+// Binary blob extraction   //
+//////////////////////////////
+
+/// \brief Blob detector for masks that are already binary.
+/// cv::SimpleBlobDetector thresholds its input at every step between minThreshold and maxThreshold and
+/// extracts contours each time, which on a binary mask only repeats the same work. This detector labels
+/// 8-connected runs of blobColor pixels in one pass over the mask (union-find over row runs), accumulates
+/// area, centroid, second moments and contour length per component on the way, and applies the same
+/// area / circularity / inertia / convexity filters as SimpleBlobDetector from those sums.
+/// Areas follow the contour convention of SimpleBlobDetector (polygon through the boundary pixel centers),
+/// so the thresholds in use keep their meaning. Upper bounds are inclusive, a perfectly round blob passes a
+/// maximum of 1.0. Buffers are kept between calls, steady-state detection does not allocate.
+class binary_blob_detector
+{
+public:
+    explicit binary_blob_detector(const cv::SimpleBlobDetector::Params& params = cv::SimpleBlobDetector::Params())
+        : _params(params) {}
+
+    void set_params(const cv::SimpleBlobDetector::Params& params) { _params = params; }
+    const cv::SimpleBlobDetector::Params& params() const { return _params; }
+
+    // mask is CV_8UC1, blobs are the components of pixels equal to params().blobColor
+    void detect(const cv::Mat& mask, std::vector<cv::KeyPoint>& keypoints)
+    {
+        CV_Assert(mask.type() == CV_8UC1);
+        keypoints.clear();
+        _runs.clear();
+        _parent.clear();
+        _stats.clear();
+
+        const uint8_t fg = _params.blobColor;
+        size_t prev_begin = 0, prev_end = 0;
+        for (int y = 0; y < mask.rows; y++)
+        {
+            const uint8_t* row = mask.ptr<uint8_t>(y);
+            const size_t cur_begin = _runs.size();
+            for (int x = 0; x < mask.cols; )
+            {
+                while (x < mask.cols && row[x] != fg) x++;
+                if (x == mask.cols) break;
+                int x0 = x;
+                while (x < mask.cols && row[x] == fg) x++;
+                _runs.push_back({ y, x0, x - 1, -1, false });
+            }
+            const size_t cur_end = _runs.size();
+
+            connect_row(prev_begin, prev_end, cur_begin, cur_end);
+            close_runs(prev_begin, prev_end);
+            prev_begin = cur_begin;
+            prev_end = cur_end;
+        }
+        close_runs(prev_begin, prev_end);
+
+        // Fold every provisional label into its root
+        for (int label = 0; label < int(_stats.size()); label++)
+        {
+            int root = find(label);
+            if (root != label)
+                _stats[root].merge(_stats[label]);
+        }
+
+        for (int label = 0; label < int(_stats.size()); label++)
+        {
+            if (_parent[label] != label)
+                continue;
+            cv::KeyPoint keypoint;
+            if (accept(label, keypoint))
+                keypoints.push_back(keypoint);
+        }
+    }
+
+private:
+    struct run
+    {
+        int y, x0, x1;     // inclusive
+        int label;
+        bool continued;    // overlaps a run in the next row (otherwise its bottom is part of the contour)
+    };
+
+    // Sums over the pixels and over the 8-connected contour of one component
+    struct blob_stats
+    {
+        double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+        double contour_length = 0;  // arcLength of the boundary pixel chain
+        double contour_steps = 0;   // number of boundary pixels on that chain
+
+        void add_run(int y, int x0, int x1)
+        {
+            double n = x1 - x0 + 1;
+            double sx = n * (x0 + x1) / 2.0;
+            double sxx = sum_squares(x1) - sum_squares(x0 - 1);
+            m00 += n;
+            m10 += sx;
+            m01 += n * y;
+            m20 += sxx;
+            m11 += sx * y;
+            m02 += n * double(y) * y;
+        }
+
+        void add_contour(double length, double steps)
+        {
+            contour_length += length;
+            contour_steps += steps;
+        }
+
+        void merge(const blob_stats& other)
+        {
+            m00 += other.m00; m10 += other.m10; m01 += other.m01;
+            m20 += other.m20; m11 += other.m11; m02 += other.m02;
+            contour_length += other.contour_length;
+            contour_steps += other.contour_steps;
+        }
+
+        static double sum_squares(double k) { return k * (k + 1) * (2 * k + 1) / 6.0; }
+    };
+
+    // Contour between two vertically adjacent run ends that are dx pixels apart:
+    // one vertical or diagonal step followed by dx - 1 horizontal ones
+    static double edge_length(int dx) { return dx == 0 ? 1.0 : std::sqrt(2.0) + (dx - 1); }
+    static double edge_steps(int dx) { return dx == 0 ? 1.0 : double(dx); }
+
+    int new_label()
+    {
+        int label = int(_parent.size());
+        _parent.push_back(label);
+        _stats.emplace_back();
+        return label;
+    }
+
+    int find(int label)
+    {
+        while (_parent[label] != label)
+        {
+            _parent[label] = _parent[_parent[label]];
+            label = _parent[label];
+        }
+        return label;
+    }
+
+    int unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b) return a;
+        if (b < a) std::swap(a, b);
+        _parent[b] = a;
+        return a;
+    }
+
+    // Labels the runs of the current row from the 8-connected runs above them and adds the contour
+    // pieces that connect the two rows. Exact for components with one run per row (convex blobs),
+    // an overestimate where components split, which only makes concave shapes less likely to pass
+    void connect_row(size_t prev_begin, size_t prev_end, size_t cur_begin, size_t cur_end)
+    {
+        size_t first = prev_begin;
+        for (size_t i = cur_begin; i < cur_end; i++)
+        {
+            run& cur = _runs[i];
+            while (first < prev_end && _runs[first].x1 + 1 < cur.x0)
+                first++;
+
+            size_t last = first;
+            int label = -1;
+            for (size_t j = first; j < prev_end && _runs[j].x0 - 1 <= cur.x1; j++)
+            {
+                _runs[j].continued = true;
+                label = label < 0 ? find(_runs[j].label) : unite(label, _runs[j].label);
+                last = j;
+            }
+
+            if (label < 0)
+            {
+                // Nothing above, the top of this run is part of the contour
+                cur.label = new_label();
+                _stats[cur.label].add_contour(cur.x1 - cur.x0, cur.x1 - cur.x0);
+            }
+            else
+            {
+                cur.label = label;
+                int dx_left = std::abs(cur.x0 - _runs[first].x0);
+                int dx_right = std::abs(cur.x1 - _runs[last].x1);
+                auto& s = _stats[label];
+                s.add_contour(edge_length(dx_left) + edge_length(dx_right), edge_steps(dx_left) + edge_steps(dx_right));
+                // Runs joined by this one enclose a gap, its underside is contour as well
+                for (size_t j = first; j < last; j++)
+                {
+                    int gap = _runs[j + 1].x0 - _runs[j].x1;
+                    s.add_contour(gap, gap);
+                }
+            }
+            _stats[cur.label].add_run(cur.y, cur.x0, cur.x1);
+        }
+    }
+
+    // Runs with nothing below them close their component from the bottom
+    void close_runs(size_t begin, size_t end)
+    {
+        for (size_t j = begin; j < end; j++)
+            if (!_runs[j].continued)
+                _stats[_runs[j].label].add_contour(_runs[j].x1 - _runs[j].x0, _runs[j].x1 - _runs[j].x0);
+    }
+
+    bool accept(int label, cv::KeyPoint& keypoint)
+    {
+        const auto& s = _stats[label];
+        const auto& p = _params;
+
+        // Pick's theorem: area of the polygon through the boundary pixel centers
+        double area = s.m00 - s.contour_steps / 2.0 - 1.0;
+        if (p.filterByArea && (area < p.minArea || area > p.maxArea))
+            return false;
+
+        if (p.filterByCircularity)
+        {
+            if (s.contour_length <= 0)
+                return false;
+            double circularity = 4 * CV_PI * area / (s.contour_length * s.contour_length);
+            if (circularity < p.minCircularity || circularity > p.maxCircularity)
+                return false;
+        }
+
+        const double cx = s.m10 / s.m00, cy = s.m01 / s.m00;
+        if (p.filterByInertia)
+        {
+            // Central moments, same ratio of principal inertias as SimpleBlobDetector
+            double mu20 = s.m20 - cx * s.m10;
+            double mu02 = s.m02 - cy * s.m01;
+            double mu11 = s.m11 - cx * s.m01;
+            double denominator = std::sqrt(4 * mu11 * mu11 + (mu20 - mu02) * (mu20 - mu02));
+            double ratio = 1.0;
+            if (denominator > 1e-2)
+            {
+                double imin = 0.5 * (mu20 + mu02) - 0.5 * denominator;
+                double imax = 0.5 * (mu20 + mu02) + 0.5 * denominator;
+                ratio = imin / imax;
+            }
+            if (ratio < p.minInertiaRatio || ratio > p.maxInertiaRatio)
+                return false;
+        }
+
+        if (p.filterByConvexity)
+        {
+            // The run ends span the component, their hull is the hull of the whole blob
+            _hull_points.clear();
+            for (const auto& r : _runs)
+            {
+                if (find(r.label) != label)
+                    continue;
+                _hull_points.push_back(cv::Point2f(float(r.x0), float(r.y)));
+                if (r.x1 != r.x0)
+                    _hull_points.push_back(cv::Point2f(float(r.x1), float(r.y)));
+            }
+            cv::convexHull(_hull_points, _hull);
+            double hull_area = cv::contourArea(_hull);
+            if (hull_area <= 0)
+                return false;
+            double convexity = area / hull_area;
+            if (convexity < p.minConvexity || convexity > p.maxConvexity)
+                return false;
+        }
+
+        keypoint = cv::KeyPoint(cv::Point2f(float(cx), float(cy)), float(2 * std::sqrt(std::max(area, 0.0) / CV_PI)));
+        return true;
+    }
+
+    cv::SimpleBlobDetector::Params _params;
+    std::vector<run> _runs;
+    std::vector<int> _parent;
+    std::vector<blob_stats> _stats;
+    std::vector<cv::Point2f> _hull_points, _hull;
+};
+
+/// \brief Runs alongside both detectors on the same masks and compares their cost and output
+class detector_comparison
+{
+public:
+    // reference holds the keypoints of cv::SimpleBlobDetector on the same mask
+    void add(double detector_ms, double reference_ms, const std::vector<cv::KeyPoint>& found, const std::vector<cv::KeyPoint>& reference)
+    {
+        _masks++;
+        _detector_ms += detector_ms;
+        _reference_ms += reference_ms;
+        _found += found.size();
+        _reference += reference.size();
+
+        // A reference blob is matched if a found blob lies within its radius (at least 2 px)
+        for (const auto& r : reference)
+        {
+            double best = -1;
+            for (const auto& f : found)
+            {
+                double dx = f.pt.x - r.pt.x, dy = f.pt.y - r.pt.y;
+                double distance = std::sqrt(dx * dx + dy * dy);
+                if (best < 0 || distance < best)
+                    best = distance;
+            }
+            if (best >= 0 && best <= std::max(2.0, r.size / 2.0))
+            {
+                _matched++;
+                _offset_sum += best;
+            }
+        }
+    }
+
+    void report(std::ostream& out) const
+    {
+        if (!_masks)
+            return;
+        out << "Blob detectors on " << _masks << " masks: binary extractor avg " << std::fixed << std::setprecision(3)
+            << _detector_ms / _masks << " ms, SimpleBlobDetector avg " << _reference_ms / _masks << " ms";
+        if (_detector_ms > 0)
+            out << " (" << std::setprecision(1) << _reference_ms / _detector_ms << "x)";
+        out << ", blobs " << _found << " vs " << _reference << ", matched " << _matched;
+        if (_matched)
+            out << " with mean offset " << std::setprecision(2) << _offset_sum / _matched << " px";
+        out << std::endl;
+    }
+
+private:
+    unsigned long long _masks = 0, _found = 0, _reference = 0, _matched = 0;
+    double _detector_ms = 0.0, _reference_ms = 0.0, _offset_sum = 0.0;
+};
+
+/// \brief Search window around a locked-on blob.
+/// While tracking, a blob is only accepted within max_distance of its last position, so nothing outside
+/// that circle (grown by the blob radius and the dilation border) has to be classified, dilated or
+/// labeled. When the blob is missed the window grows by the blob's recent speed for every missed frame,
+/// so it can be found again where it has moved meanwhile, and by at least MIN_GROWTH of max_distance, so that
+/// the hold also widens the search around a blob that stood still before it was hidden. Once the hold expires
+/// the caller goes back to searching the full frame.
+class tracking_window
+{
+public:
+    // Least growth of the reach per missed frame, as a fraction of max_distance
+    static constexpr float MIN_GROWTH = 0.2f;
+
+    // Lock-on, forget the motion of the previous target
+    void reset(const cv::KeyPoint& blob)
+    {
+        _last = blob.pt;
+        _speed = 0.0f;
+        _missed = 0;
+    }
+
+    void found(const cv::KeyPoint& blob)
+    {
+        float dx = blob.pt.x - _last.x, dy = blob.pt.y - _last.y;
+        float step = std::sqrt(dx * dx + dy * dy) / (_missed + 1);
+        _speed = _speed * 0.7f + step * 0.3f;
+        _last = blob.pt;
+        _missed = 0;
+    }
+
+    void missed() { _missed++; }
+
+    // Maximum distance from the last position at which the blob is accepted
+    float reach(int max_distance) const { return max_distance + std::max(_speed, MIN_GROWTH * max_distance) * _missed; }
+
+    // Window around the blob, clipped to the frame. border is the extra margin filters need (dilation)
+    cv::Rect window(const cv::KeyPoint& blob, int max_distance, int border, cv::Size frame) const
+    {
+        int half = int(std::ceil(reach(max_distance) + blob.size / 2 + border)) + 1;
+        cv::Rect r(int(blob.pt.x) - half, int(blob.pt.y) - half, 2 * half + 1, 2 * half + 1);
+        return r & cv::Rect(0, 0, frame.width, frame.height);
+    }
+
+private:
+    cv::Point2f _last;
+    float _speed = 0.0f;  // pixels per frame, smoothed
+    int _missed = 0;
+};
+
+// Closest blob keypoint to a pixel or to the previous blob, throws std::runtime_error if there is none within maxDistance
+inline cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const std::pair<int, int>& pixel, int maxDistance) {
+    if (keypoints.empty()) {
+        throw std::runtime_error("The keypoints vector is empty.");
+    }
+
+    double minDistance = std::numeric_limits<double>::max();
+    cv::KeyPoint closestKeypoint;
+    bool found = false;
+
+    for (const auto& keypoint : keypoints) {
+        double dx = keypoint.pt.x - pixel.first;
+        double dy = keypoint.pt.y - pixel.second;
+        double distance = std::sqrt(dx * dx + dy * dy);
+
+        if (distance < minDistance) {
+            minDistance = distance;
+            closestKeypoint = keypoint;
+            found = true;
+        }
+    }
+
+    if (!found || minDistance > maxDistance) {
+        throw std::runtime_error("No keypoints found within the maximum distance.");
+    }
+
+    return closestKeypoint;
+}
+
+inline cv::KeyPoint findClosestKeypoint(const std::vector<cv::KeyPoint>& keypoints, const cv::KeyPoint& referenceKeypoint, int maxDistance) {
+    if (keypoints.empty()) {
+        throw std::runtime_error("The keypoints vector is empty.");
+    }
+
+    double minDistance = std::numeric_limits<double>::max();
+    cv::KeyPoint closestKeypoint;
+    bool found = false;
+
+    for (const auto& keypoint : keypoints) {
+        double dx = keypoint.pt.x - referenceKeypoint.pt.x;
+        double dy = keypoint.pt.y - referenceKeypoint.pt.y;
+        double distance = std::sqrt(dx * dx + dy * dy);
+
+        if (distance < minDistance) {
+            minDistance = distance;
+            closestKeypoint = keypoint;
+            found = true;
+        }
+    }
+
+    if (!found || minDistance > maxDistance) {
+        throw std::runtime_error("No keypoints found within the maximum distance.");
+    }
+
+    return closestKeypoint;
+}
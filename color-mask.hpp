@@ -0,0 +1,284 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLOR_MASK_SSE2 1
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//////////////////////////////
+// Color classification     //
+//////////////////////////////
+
+// Lab color of a single RGB pixel, on OpenCV's 8-bit Lab scale (L * 255 / 100, a + 128, b + 128)
+inline cv::Vec3b rgb_to_lab(const cv::Vec3b& rgb)
+{
+    cv::Mat3b pixel(1, 1, rgb), lab;
+    cv::cvtColor(pixel, lab, cv::COLOR_RGB2Lab);
+    return lab(0, 0);
+}
+
+/// \brief Quantized RGB -> "inside the Lab box" lookup table.
+/// Classifies an RGB8 image against a Lab range in a single pass: every pixel costs one table load
+/// instead of a float Lab conversion followed by inRange on a 3-channel intermediate image.
+/// Each entry holds the verdict for the center of its RGB bin, computed with the same cvtColor
+/// conversion the unfused path used. The table only has to be rebuilt when the box changes.
+class lab_box_lut
+{
+public:
+    // Bits kept per channel. 6 bits is a 256 KB table and an RGB error of at most 2 per channel,
+    // well below the Lab thresholds in use
+    static const int BITS = 6;
+    static const int SHIFT = 8 - BITS;
+    static const int BINS = 1 << BITS;
+
+    lab_box_lut() : _table(size_t(BINS) * BINS * BINS, 0) {}
+
+    // Rebuilds the table if the box differs from the one it was built for, returns true if it did
+    bool update(const cv::Scalar& lab_min, const cv::Scalar& lab_max)
+    {
+        if (_built && lab_min == _min && lab_max == _max)
+            return false;
+        _min = lab_min;
+        _max = lab_max;
+        _built = true;
+
+        // Convert the center of every bin in one go, BINS^2 x BINS image laid out like the table
+        if (_bin_lab.empty())
+        {
+            cv::Mat3b centers(BINS * BINS, BINS);
+            const int half = (1 << SHIFT) / 2;
+            for (int r = 0; r < BINS; r++)
+                for (int g = 0; g < BINS; g++)
+                    for (int b = 0; b < BINS; b++)
+                        centers(r * BINS + g, b) = cv::Vec3b(uint8_t((r << SHIFT) + half), uint8_t((g << SHIFT) + half), uint8_t((b << SHIFT) + half));
+            cv::cvtColor(centers, _bin_lab, cv::COLOR_RGB2Lab);
+        }
+
+        const cv::Vec3b* lab = _bin_lab[0];
+        for (size_t i = 0; i < _table.size(); i++)
+        {
+            bool inside = true;
+            for (int c = 0; c < 3; c++)
+                inside = inside && lab[i][c] >= _min[c] && lab[i][c] <= _max[c];
+            _table[i] = inside ? 255 : 0;
+        }
+        return true;
+    }
+
+    // rgb is CV_8UC3 in R, G, B order, mask receives CV_8UC1 with 255 inside the box, 0 outside
+    void apply(const cv::Mat& rgb, cv::Mat& mask) const
+    {
+        CV_Assert(rgb.type() == CV_8UC3);
+        mask.create(rgb.size(), CV_8UC1);
+        const uint8_t* table = _table.data();
+        for (int y = 0; y < rgb.rows; y++)
+        {
+            const uint8_t* src = rgb.ptr<uint8_t>(y);
+            uint8_t* dst = mask.ptr<uint8_t>(y);
+            for (int x = 0; x < rgb.cols; x++, src += 3)
+                dst[x] = table[((src[0] >> SHIFT) << (2 * BITS)) | ((src[1] >> SHIFT) << BITS) | (src[2] >> SHIFT)];
+        }
+    }
+
+private:
+    std::vector<uint8_t> _table;
+    cv::Mat3b _bin_lab;  // Lab of every bin center, the expensive part, converted once
+    cv::Scalar _min, _max;
+    bool _built = false;
+};
+
+/// \brief Binary dilation by a (2 * radius + 1) square, the structuring element BlobTracker builds with
+/// getStructuringElement(MORPH_RECT), at a cost that does not grow with the radius.
+/// Nonzero pixels are packed 64 to a word. The row pass finds the runs of set pixels a word at a time, grows each
+/// by radius on either side, merges the ones that overlap and fills them word by word, so a row costs its words
+/// plus its runs for any radius. The column pass is the van Herk / Gil-Werman max filter over the packed rows:
+/// per block of 2 * radius + 1 rows a running OR from the block start and one from the block end are kept, and
+/// every output row is one OR of the two, 3 word operations per 64 pixels for any radius.
+/// Unpacking writes 255 / 0 through a byte -> 8 pixels table, or 0 / 255 when invert is set, which folds the
+/// 255 - mask that used to follow into the same pass. Pixels outside the image do not contribute, like the default
+/// border of cv::dilate. The rectangle needs no element to be built, and the packed buffers are kept between calls
+class rect_dilation
+{
+public:
+    rect_dilation()
+    {
+        for (int b = 0; b < 256; b++)
+            for (int i = 0; i < 8; i++)
+            {
+                _unpack[0][b * 8 + i] = (b >> i) & 1 ? 255 : 0;
+                _unpack[1][b * 8 + i] = (b >> i) & 1 ? 0 : 255;
+            }
+    }
+
+    // mask is CV_8UC1, dst receives CV_8UC1 with 255 where a nonzero pixel lies within radius (0 with invert).
+    // dst may be mask
+    void apply(const cv::Mat& mask, cv::Mat& dst, int radius, bool invert = false)
+    {
+        CV_Assert(mask.type() == CV_8UC1 && radius >= 0);
+        const int width = mask.cols, height = mask.rows;
+        _words = (width + 63) / 64;
+        const int pad = radius;
+        const int rows = height + 2 * pad; // zero rows above and below, outside pixels do not contribute
+        _bits.assign(size_t(rows) * _words, 0);
+        for (int y = 0; y < height; y++)
+        {
+            uint64_t* row = &_bits[size_t(y + pad) * _words];
+            pack(mask.ptr<uint8_t>(y), width, row);
+            dilate_row(row, width, radius);
+        }
+
+        dst.create(height, width, CV_8UC1);
+        const uint8_t* table = _unpack[invert ? 1 : 0];
+        if (radius == 0)
+        {
+            for (int y = 0; y < height; y++)
+                unpack(&_bits[size_t(y) * _words], width, table, dst.ptr<uint8_t>(y));
+            return;
+        }
+
+        // van Herk / Gil-Werman: prefix and suffix ORs within blocks of 2 * radius + 1 rows
+        const int block = 2 * radius + 1;
+        _prefix.resize(_bits.size());
+        _suffix.resize(_bits.size());
+        for (int start = 0; start < rows; start += block)
+        {
+            int end = std::min(start + block, rows);
+            for (int y = start; y < end; y++)
+                for (int w = 0; w < _words; w++)
+                    _prefix[size_t(y) * _words + w] = _bits[size_t(y) * _words + w] | (y > start ? _prefix[size_t(y - 1) * _words + w] : 0);
+            for (int y = end - 1; y >= start; y--)
+                for (int w = 0; w < _words; w++)
+                    _suffix[size_t(y) * _words + w] = _bits[size_t(y) * _words + w] | (y < end - 1 ? _suffix[size_t(y + 1) * _words + w] : 0);
+        }
+        _row.resize(size_t(_words));
+        for (int y = 0; y < height; y++)
+        {
+            // the window of output row y is padded rows [y, y + 2 * radius], across at most two blocks
+            const uint64_t* first = &_suffix[size_t(y) * _words];
+            const uint64_t* last = &_prefix[size_t(y + 2 * radius) * _words];
+            for (int w = 0; w < _words; w++)
+                _row[w] = first[w] | last[w];
+            unpack(_row.data(), width, table, dst.ptr<uint8_t>(y));
+        }
+    }
+
+private:
+    // bits must be zeroed
+    static void pack(const uint8_t* src, int width, uint64_t* bits)
+    {
+        int x = 0;
+#ifdef COLOR_MASK_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+            uint64_t set = uint64_t(~_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero)) & 0xFFFF);
+            bits[x >> 6] |= set << (x & 63);
+        }
+#endif
+        for (; x < width; x++)
+            bits[x >> 6] |= uint64_t(src[x] != 0) << (x & 63);
+    }
+
+    static int lowest_bit(uint64_t bits)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return int(index);
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, (unsigned long)bits))
+            return int(index);
+        _BitScanForward(&index, (unsigned long)(bits >> 32));
+        return 32 + int(index);
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+    // First pixel at or after x whose bit is set (or clear when set is false), width if there is none
+    static int next_bit(const uint64_t* bits, int words, int width, int x, bool set)
+    {
+        if (x >= width) return width;
+        int w = x >> 6;
+        uint64_t word = (set ? bits[w] : ~bits[w]) & (~uint64_t(0) << (x & 63));
+        while (!word)
+        {
+            if (++w == words) return width;
+            word = set ? bits[w] : ~bits[w];
+        }
+        return std::min(width, (w << 6) + lowest_bit(word));
+    }
+
+    // Sets pixels [begin, end)
+    static void fill(uint64_t* bits, int begin, int end)
+    {
+        if (begin >= end) return;
+        int first = begin >> 6, last = (end - 1) >> 6;
+        uint64_t head = ~uint64_t(0) << (begin & 63);
+        uint64_t tail = ~uint64_t(0) >> (63 - ((end - 1) & 63));
+        if (first == last)
+        {
+            bits[first] |= head & tail;
+            return;
+        }
+        bits[first] |= head;
+        for (int w = first + 1; w < last; w++)
+            bits[w] = ~uint64_t(0);
+        bits[last] |= tail;
+    }
+
+    // Each run of set pixels grows by radius on either side. The runs are found a word at a time and the grown
+    // runs merged before they are filled, so every output word is written about once: the row costs its words
+    // plus its runs, whatever the radius
+    void dilate_row(uint64_t* row, int width, int radius)
+    {
+        if (radius == 0) return;
+        _row.assign(row, row + _words);
+        std::fill(row, row + _words, uint64_t(0));
+        int begin = 0, end = -1; // grown run waiting to be filled, [begin, end)
+        for (int x = next_bit(_row.data(), _words, width, 0, true); x < width;)
+        {
+            int run_end = next_bit(_row.data(), _words, width, x, false);
+            int grown_begin = std::max(0, x - radius), grown_end = std::min(width, run_end + radius);
+            if (grown_begin <= end)
+                end = grown_end;
+            else
+            {
+                fill(row, begin, end);
+                begin = grown_begin;
+                end = grown_end;
+            }
+            x = next_bit(_row.data(), _words, width, run_end, true);
+        }
+        fill(row, begin, end);
+    }
+
+    static void unpack(const uint64_t* bits, int width, const uint8_t* table, uint8_t* dst)
+    {
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+            std::memcpy(dst + x, table + 8 * ((bits[x >> 6] >> (x & 63)) & 0xFF), 8);
+        for (; x < width; x++)
+            dst[x] = table[8 * ((bits[x >> 6] >> (x & 63)) & 1)];
+    }
+
+    int _words = 0;
+    std::vector<uint64_t> _bits;    // packed mask, padded with radius empty rows at the top and bottom
+    std::vector<uint64_t> _prefix;  // OR from the start of each block of rows
+    std::vector<uint64_t> _suffix;  // OR to the end of each block
+    std::vector<uint64_t> _row;     // a row before its dilation, then an output row
+    uint8_t _unpack[2][256 * 8];    // 8 output pixels per packed byte, plain and inverted
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEPTH_SAMPLER_SSE2 1
+#endif
+
+//////////////////////////////
+// Depth sampling           //
+//////////////////////////////
+
+/// \brief Depth of a blob, from all of its pixels that have depth
+struct depth_sample
+{
+    float depth = 0;    // m, 0 if no pixel of the footprint had depth
+    int valid = 0;      // footprint pixels with depth, the statistic is taken over these
+    int footprint = 0;  // pixels in the footprint
+};
+
+/// \brief Blob in color pixel coordinates: the circle around its center, optionally restricted to the pixels of a
+/// mask that have value (the inverted tracking mask, where blob pixels are 0). The mask covers the color rectangle
+/// (x, y, width, height), e.g. the search window it was computed in
+struct blob_footprint
+{
+    float center[2] = { 0, 0 };
+    float radius = 0;
+    const uint8_t* mask = nullptr;
+    int mask_stride = 0;
+    int mask_x = 0, mask_y = 0, mask_width = 0, mask_height = 0;
+    uint8_t value = 0;
+};
+
+/// \brief Robust depth of blobs: the median, or the mean with the nearest and farthest trim fraction left out, of
+/// the Z16 values under the blob's footprint instead of get_distance() at a single pixel.
+/// The raw buffer is read directly and scaled once by the depth units. The footprint is scanned row by row over
+/// the circle's span; with SSE2, 8 depth pixels and their mask bytes are tested at a time, and runs where all of
+/// them are valid (the inside of a blob) are copied to the sample buffer with one store. The buffer is kept
+/// between calls, sampling does not allocate once it has grown to the largest blob
+class depth_sampler
+{
+public:
+    enum statistic { median, trimmed_mean };
+
+    explicit depth_sampler(statistic stat = median, float trim = 0.2f) : _statistic(stat), _trim(trim) {}
+
+    // scale_x / scale_y: depth pixels per color pixel (below 1 with decimation)
+    depth_sample sample(const rs2::depth_frame& depth, float scale_x, float scale_y, const blob_footprint& blob)
+    {
+        if (depth.get_profile().format() != RS2_FORMAT_Z16)
+            throw std::runtime_error("depth_sampler expects Z16 depth");
+        depth_sample result;
+        _values.clear();
+
+        const int width = depth.get_width(), height = depth.get_height();
+        const auto data = static_cast<const uint8_t*>(depth.get_data());
+        const int stride = depth.get_stride_in_bytes();
+        const float cx = blob.center[0] * scale_x, cy = blob.center[1] * scale_y;
+        const float rx = blob.radius * scale_x, ry = blob.radius * scale_y;
+        if (rx <= 0 || ry <= 0)
+            return result;
+        // a mask at color resolution can be read in place when depth is not decimated
+        const bool direct = blob.mask && scale_x == 1.f && scale_y == 1.f;
+
+        int y_begin = std::max(0, int(std::ceil(cy - ry))), y_end = std::min(height - 1, int(std::floor(cy + ry)));
+        for (int y = y_begin; y <= y_end; y++)
+        {
+            float dy = (y - cy) / ry;
+            float half = rx * std::sqrt(std::max(0.f, 1.f - dy * dy));
+            int x_begin = std::max(0, int(std::ceil(cx - half))), x_end = std::min(width - 1, int(std::floor(cx + half))) + 1;
+            // the rest of the row is off the mask
+            int mask_row = blob.mask ? int((y + 0.5f) / scale_y) - blob.mask_y : 0;
+            if (blob.mask && (mask_row < 0 || mask_row >= blob.mask_height))
+                continue;
+            if (direct)
+            {
+                x_begin = std::max(x_begin, blob.mask_x);
+                x_end = std::min(x_end, blob.mask_x + blob.mask_width);
+            }
+            if (x_begin >= x_end)
+                continue;
+
+            const uint8_t* mask;
+            if (direct)
+                mask = blob.mask + size_t(mask_row) * blob.mask_stride + (x_begin - blob.mask_x);
+            else
+            {
+                // the footprint of this row at depth resolution
+                _row_mask.resize(size_t(x_end - x_begin));
+                for (int x = x_begin; x < x_end; x++)
+                {
+                    int mask_column = blob.mask ? int((x + 0.5f) / scale_x) - blob.mask_x : 0;
+                    bool inside = !blob.mask || (mask_column >= 0 && mask_column < blob.mask_width
+                        && blob.mask[size_t(mask_row) * blob.mask_stride + mask_column] == blob.value);
+                    _row_mask[x - x_begin] = inside ? blob.value : uint8_t(blob.value ^ 0xFF);
+                }
+                mask = _row_mask.data();
+            }
+            auto z16 = reinterpret_cast<const uint16_t*>(data + size_t(y) * stride) + x_begin;
+            result.footprint += collect(z16, mask, blob.value, x_end - x_begin);
+        }
+
+        result.valid = int(_values.size());
+        if (result.valid)
+            result.depth = float(statistic_of(_values)) * depth.get_units();
+        return result;
+    }
+
+    // One sample per blob, in the same order
+    void sample(const rs2::depth_frame& depth, float scale_x, float scale_y, const std::vector<blob_footprint>& blobs,
+        std::vector<depth_sample>& samples)
+    {
+        samples.resize(blobs.size());
+        for (size_t i = 0; i < blobs.size(); i++)
+            samples[i] = sample(depth, scale_x, scale_y, blobs[i]);
+    }
+
+private:
+    // Appends the depth of the pixels whose mask byte is value and whose depth is not 0, returns the number of
+    // pixels whose mask byte is value
+    int collect(const uint16_t* z16, const uint8_t* mask, uint8_t value, int count)
+    {
+        int footprint = 0;
+        int i = 0;
+        size_t used = _values.size();
+        _values.resize(used + size_t(count)); // room for all of them, shrunk to what was kept below
+        uint16_t* out = _values.data() + used;
+#ifdef DEPTH_SAMPLER_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wanted = _mm_set1_epi16(value);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i z = _mm_loadu_si128(reinterpret_cast<const __m128i*>(z16 + i));
+            __m128i m = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + i)), zero);
+            __m128i in_blob = _mm_cmpeq_epi16(m, wanted);
+            __m128i valid = _mm_andnot_si128(_mm_cmpeq_epi16(z, zero), in_blob);
+            int in_bits = _mm_movemask_epi8(in_blob);   // 2 bits per pixel
+            int valid_bits = _mm_movemask_epi8(valid);
+            if (valid_bits == 0xFFFF)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), z);
+                out += 8;
+                footprint += 8;
+                continue;
+            }
+            for (int k = 0; k < 8; k++)
+            {
+                footprint += (in_bits >> (2 * k)) & 1;
+                if ((valid_bits >> (2 * k)) & 1)
+                    *out++ = z16[i + k];
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            if (mask[i] != value) continue;
+            footprint++;
+            if (z16[i])
+                *out++ = z16[i];
+        }
+        _values.resize(size_t(out - _values.data()));
+        return footprint;
+    }
+
+    // Median or trimmed mean of the raw values, reorders them
+    double statistic_of(std::vector<uint16_t>& values) const
+    {
+        size_t n = values.size();
+        if (_statistic == median)
+        {
+            std::nth_element(values.begin(), values.begin() + n / 2, values.end());
+            return values[n / 2];
+        }
+        size_t low = std::min(size_t(n * _trim), (n - 1) / 2);
+        size_t high = n - low;
+        std::nth_element(values.begin(), values.begin() + low, values.end());
+        if (high < n)
+            std::nth_element(values.begin() + low, values.begin() + high, values.end());
+        double sum = 0;
+        for (size_t i = low; i < high; i++)
+            sum += values[i];
+        return sum / double(high - low);
+    }
+
+    statistic _statistic;
+    float _trim;                     // fraction left out at each end for the trimmed mean
+    std::vector<uint16_t> _values;   // raw depth of the valid footprint pixels
+    std::vector<uint8_t> _row_mask;  // footprint of a row, when the mask can not be read in place
+};
@@ -17,9 +17,12 @@
 #include <cmath>
 #include <map>
 #include <functional>
+#include <cstring>
+#include <cstddef>
 
 #include "../third-party/stb_easy_font.h"
 #include "example-utils.hpp"
+#include "gl-renderer.hpp"
 
 #ifndef PI
 #define PI  3.14159265358979323846
@@ -114,8 +117,8 @@ using frames_mosaic = std::map<int, frame_and_tile_property>;
 
 inline void draw_text(int x, int y, const char* text)
 {
-    std::vector<char> buffer;
-    buffer.resize(60000); // ~300 chars
+    // Allocated once, the drawing happens on the thread that owns the context
+    static std::vector<char> buffer(60000); // ~300 chars
     glEnableClientState(GL_VERTEX_ARRAY);
     glVertexPointer(2, GL_FLOAT, 16, &(buffer[0]) );
     glDrawArrays( GL_QUADS,
@@ -413,11 +416,82 @@ struct text_renderer
 ////////////////////////
 // Image display code //
 ////////////////////////
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+// Pixel buffer object entry points (OpenGL 2.1, also used for vertex buffers). The OpenGL 1.1 headers of Windows do not declare them,
+// so they are looked up at run time, with a current context. available is false if any is missing
+struct pixel_buffer_api
+{
+    typedef void (GLAPIENTRY* gen_buffers_fn)(GLsizei, GLuint*);
+    typedef void (GLAPIENTRY* delete_buffers_fn)(GLsizei, const GLuint*);
+    typedef void (GLAPIENTRY* bind_buffer_fn)(GLenum, GLuint);
+    typedef void (GLAPIENTRY* buffer_data_fn)(GLenum, ptrdiff_t, const void*, GLenum);
+    typedef void (GLAPIENTRY* buffer_sub_data_fn)(GLenum, ptrdiff_t, ptrdiff_t, const void*);
+    typedef void* (GLAPIENTRY* map_buffer_fn)(GLenum, GLenum);
+    typedef GLboolean(GLAPIENTRY* unmap_buffer_fn)(GLenum);
+
+    gen_buffers_fn gen_buffers = nullptr;
+    delete_buffers_fn delete_buffers = nullptr;
+    bind_buffer_fn bind_buffer = nullptr;
+    buffer_data_fn buffer_data = nullptr;
+    buffer_sub_data_fn buffer_sub_data = nullptr;
+    map_buffer_fn map_buffer = nullptr;
+    unmap_buffer_fn unmap_buffer = nullptr;
+    bool available = false;
+
+    static const pixel_buffer_api& get()
+    {
+        static pixel_buffer_api api = load();
+        return api;
+    }
+
+private:
+    static pixel_buffer_api load()
+    {
+        pixel_buffer_api api;
+        api.gen_buffers = (gen_buffers_fn)glfwGetProcAddress("glGenBuffers");
+        api.delete_buffers = (delete_buffers_fn)glfwGetProcAddress("glDeleteBuffers");
+        api.bind_buffer = (bind_buffer_fn)glfwGetProcAddress("glBindBuffer");
+        api.buffer_data = (buffer_data_fn)glfwGetProcAddress("glBufferData");
+        api.buffer_sub_data = (buffer_sub_data_fn)glfwGetProcAddress("glBufferSubData");
+        api.map_buffer = (map_buffer_fn)glfwGetProcAddress("glMapBuffer");
+        api.unmap_buffer = (unmap_buffer_fn)glfwGetProcAddress("glUnmapBuffer");
+        api.available = api.gen_buffers && api.delete_buffers && api.bind_buffer && api.buffer_data && api.buffer_sub_data && api.map_buffer && api.unmap_buffer;
+        return api;
+    }
+};
+
 /// \brief The texture class
 class texture
 {
 public:
+    // Pixel buffers the uploads rotate through, the one being filled is never the one a transfer may still read
+    static const int PBO_COUNT = 2;
+
+    texture() = default;
+    // The pixel buffers go with the texture, when its context is still current (it is gone once the window is)
+    ~texture()
+    {
+        if (_pbo[0] && glfwGetCurrentContext())
+            pixel_buffer_api::get().delete_buffers(PBO_COUNT, _pbo);
+    }
+
+    // Owns its pixel buffers
+    texture(const texture&) = delete;
+    texture& operator=(const texture&) = delete;
 
+    // Texture storage is allocated once per format and size, every frame after that is copied into it with
+    // glTexSubImage2D. With pixel buffer objects the frame is copied into the next buffer of a ring and the
+    // driver transfers it to the texture asynchronously, the CPU does not wait for the copy to the GPU.
+    // Without them (OpenGL < 2.1) the frame is uploaded straight from client memory, synchronously
     void upload(const rs2::video_frame& frame)
     {
         if (!frame) return;
@@ -432,34 +506,80 @@ public:
         _stream_type = frame.get_profile().stream_type();
         _stream_index = frame.get_profile().stream_index();
 
-        glBindTexture(GL_TEXTURE_2D, _gl_handle);
-
+        GLenum internal_format, data_format, data_type;
         switch (format)
         {
         case RS2_FORMAT_RGB8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, frame.get_data());
+            internal_format = GL_RGB; data_format = GL_RGB; data_type = GL_UNSIGNED_BYTE;
             break;
         case RS2_FORMAT_RGBA8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, frame.get_data());
+            internal_format = GL_RGBA; data_format = GL_RGBA; data_type = GL_UNSIGNED_BYTE;
             break;
         case RS2_FORMAT_Y8:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame.get_data());
+            internal_format = GL_RGB; data_format = GL_LUMINANCE; data_type = GL_UNSIGNED_BYTE;
             break;
         case RS2_FORMAT_Y10BPACK:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_SHORT, frame.get_data());
+            internal_format = GL_LUMINANCE; data_format = GL_LUMINANCE; data_type = GL_UNSIGNED_SHORT;
             break;
         default:
             throw std::runtime_error("The requested format is not supported by this demo!");
         }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+        glBindTexture(GL_TEXTURE_2D, _gl_handle);
+
+        if (format != _format || width != _width || height != _height)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, data_format, data_type, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+            _format = format;
+            _width = width;
+            _height = height;
+        }
+
+        // Rows may be padded
+        auto bpp = data_type == GL_UNSIGNED_SHORT ? 2 : (data_format == GL_RGBA ? 4 : (data_format == GL_RGB ? 3 : 1));
+        auto stride = frame.get_stride_in_bytes();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride % bpp == 0 ? stride / bpp : 0);
+
+        auto& pbo = pixel_buffer_api::get();
+        auto size = size_t(stride) * height;
+        void* mapped = nullptr;
+        if (pbo.available)
+        {
+            if (!_pbo[0])
+                pbo.gen_buffers(PBO_COUNT, _pbo);
+            pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, _pbo[_pbo_index]);
+            // Orphan the previous storage, a transfer still reading it keeps it alive and does not block the map
+            pbo.buffer_data(GL_PIXEL_UNPACK_BUFFER, ptrdiff_t(size), nullptr, GL_STREAM_DRAW);
+            mapped = pbo.map_buffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        }
+        if (mapped)
+        {
+            std::memcpy(mapped, frame.get_data(), size);
+            pbo.unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, data_format, data_type, nullptr); // from the bound buffer
+            pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            _pbo_index = (_pbo_index + 1) % PBO_COUNT;
+        }
+        else
+        {
+            if (pbo.available)
+                pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, data_format, data_type, frame.get_data());
+        }
+
         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glBindTexture(GL_TEXTURE_2D, 0);
     }
 
+    // Immediate-mode drawing (glBegin) with the stream name over the image. Kept for render(frame, rect) and the
+    // window's show() overloads, which draw one texture at a time between the imu and pose renderers; the apps
+    // queue their frames with render(gl_renderer&, ...) instead
     void show(const rect& r, float alpha = 1.f) const
     {
         if (!_gl_handle)
@@ -502,8 +622,23 @@ public:
             throw std::runtime_error("Rendering is currently supported for video, motion and pose frames only");
     }
 
+    // Uploads the frame and queues it on the renderer, it is drawn by the next flush(). Unlike show(), the
+    // stream name is not drawn over the image
+    void render(gl_renderer& renderer, const rs2::video_frame& frame, const rect& r, float alpha = 1.f)
+    {
+        if (!frame) return;
+        upload(frame);
+        auto fitted = r.adjust_ratio({ (float)frame.get_width(), (float)frame.get_height() });
+        renderer.image(_gl_handle, fitted.x, fitted.y, fitted.w, fitted.h, alpha);
+    }
+
 private:
     GLuint          _gl_handle = 0;
+    rs2_format      _format = RS2_FORMAT_ANY; // of the allocated storage
+    int             _width = 0;
+    int             _height = 0;
+    GLuint          _pbo[PBO_COUNT] = {};
+    int             _pbo_index = 0;
     rs2_stream      _stream_type = RS2_STREAM_ANY;
     int             _stream_index{};
     imu_renderer    _imu_render;
@@ -924,6 +1059,437 @@ struct window_key_listener {
     }
 };
 
+////////////////////////
+// Point cloud buffer //
+////////////////////////
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define POINT_CLOUD_SSE 1
+#endif
+
+// Persistently mapped buffer entry points (OpenGL 4.4 or ARB_buffer_storage, and fences from OpenGL 3.2 or
+// ARB_sync), looked up at run time like pixel_buffer_api. A driver may export the functions without supporting
+// them, so available is also false if the context has neither the version nor the extensions. Sync objects are
+// passed around as void*
+struct persistent_buffer_api
+{
+    typedef void (GLAPIENTRY* buffer_storage_fn)(GLenum, ptrdiff_t, const void*, GLbitfield);
+    typedef void* (GLAPIENTRY* map_buffer_range_fn)(GLenum, ptrdiff_t, ptrdiff_t, GLbitfield);
+    typedef void* (GLAPIENTRY* fence_sync_fn)(GLenum, GLbitfield);
+    typedef GLenum(GLAPIENTRY* client_wait_sync_fn)(void*, GLbitfield, unsigned long long);
+    typedef void (GLAPIENTRY* delete_sync_fn)(void*);
+
+    buffer_storage_fn buffer_storage = nullptr;
+    map_buffer_range_fn map_buffer_range = nullptr;
+    fence_sync_fn fence_sync = nullptr;
+    client_wait_sync_fn client_wait_sync = nullptr;
+    delete_sync_fn delete_sync = nullptr;
+    bool available = false;
+
+    static const persistent_buffer_api& get()
+    {
+        static persistent_buffer_api api = load();
+        return api;
+    }
+
+private:
+    static persistent_buffer_api load()
+    {
+        persistent_buffer_api api;
+        api.buffer_storage = (buffer_storage_fn)glfwGetProcAddress("glBufferStorage");
+        api.map_buffer_range = (map_buffer_range_fn)glfwGetProcAddress("glMapBufferRange");
+        api.fence_sync = (fence_sync_fn)glfwGetProcAddress("glFenceSync");
+        api.client_wait_sync = (client_wait_sync_fn)glfwGetProcAddress("glClientWaitSync");
+        api.delete_sync = (delete_sync_fn)glfwGetProcAddress("glDeleteSync");
+        api.available = api.buffer_storage && api.map_buffer_range && api.fence_sync && api.client_wait_sync && api.delete_sync
+            && supports(4, 4, "GL_ARB_buffer_storage") && supports(3, 0, "GL_ARB_map_buffer_range") && supports(3, 2, "GL_ARB_sync");
+        return api;
+    }
+
+    // The current context is at least OpenGL major.minor or has the extension
+    static bool supports(int major, int minor, const char* extension)
+    {
+        auto window = glfwGetCurrentContext();
+        if (!window) return false;
+        int context_major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
+        int context_minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
+        if (context_major > major || (context_major == major && context_minor >= minor))
+            return true;
+        return glfwExtensionSupported(extension) == GLFW_TRUE;
+    }
+};
+
+// Copies the points that have depth (z != 0, like the original loop tested) and their texture coordinates,
+// packed: out_vertices gets 3 floats per point, out_tex_coords 2. Returns the number of points kept.
+// With SSE the points are tested 4 at a time: a group that is all valid (most of a depth image) is copied with
+// 5 vector stores, a group without depth is skipped, only mixed groups are copied point by point
+inline size_t compact_valid_points(const rs2::vertex* vertices, const rs2::texture_coordinate* tex_coords, size_t count,
+    float* out_vertices, float* out_tex_coords)
+{
+    const float* v = &vertices[0].x;
+    const float* t = &tex_coords[0].u;
+    size_t kept = 0;
+    size_t i = 0;
+#ifdef POINT_CLOUD_SSE
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4, v += 12, t += 8)
+    {
+        __m128 a = _mm_loadu_ps(v);     // x0 y0 z0 x1
+        __m128 b = _mm_loadu_ps(v + 4); // y1 z1 x2 y2
+        __m128 c = _mm_loadu_ps(v + 8); // z2 x3 y3 z3
+        __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+            _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        int valid = _mm_movemask_ps(_mm_cmpneq_ps(z, zero));
+        if (valid == 0xF)
+        {
+            float* ov = out_vertices + 3 * kept;
+            float* ot = out_tex_coords + 2 * kept;
+            _mm_storeu_ps(ov, a);
+            _mm_storeu_ps(ov + 4, b);
+            _mm_storeu_ps(ov + 8, c);
+            _mm_storeu_ps(ot, _mm_loadu_ps(t));
+            _mm_storeu_ps(ot + 4, _mm_loadu_ps(t + 4));
+            kept += 4;
+        }
+        else
+        {
+            for (int k = 0; valid; k++, valid >>= 1)
+            {
+                if (!(valid & 1)) continue;
+                std::memcpy(out_vertices + 3 * kept, v + 3 * k, 3 * sizeof(float));
+                std::memcpy(out_tex_coords + 2 * kept, t + 2 * k, 2 * sizeof(float));
+                kept++;
+            }
+        }
+    }
+#endif
+    for (; i < count; i++, v += 3, t += 2)
+    {
+        if (!v[2]) continue;
+        std::memcpy(out_vertices + 3 * kept, v, 3 * sizeof(float));
+        std::memcpy(out_tex_coords + 2 * kept, t, 2 * sizeof(float));
+        kept++;
+    }
+    return kept;
+}
+
+/// \brief The points of a point cloud that have depth, in a vertex buffer drawn with a single glDrawArrays.
+/// The buffer holds REGIONS copies of the largest cloud seen, each split into the vertices and the texture
+/// coordinates. With persistent mapping (OpenGL 4.4) it is mapped once and every frame is compacted straight into
+/// the next region, after waiting on the fence of the draw that last read it; a frame whose region is still busy
+/// after FENCE_TIMEOUT_NS is drawn from client memory. Without it (OpenGL 1.5 to 4.3, or if the mapping fails) the
+/// storage is orphaned and mapped every frame, and with no buffer objects at all the points are compacted into
+/// client memory and drawn from there
+class point_cloud_buffer
+{
+public:
+    // Regions the frames rotate through, the one being filled is never one the GPU may still be drawing from
+    static const int REGIONS = 3;
+    // How long upload() waits for the GPU to release a region before it draws from client memory
+    static const unsigned long long FENCE_TIMEOUT_NS = 100000000ull;
+
+    // Packs the points with depth into the buffer, needs the context current
+    void upload(const rs2::points& points)
+    {
+        _count = 0;
+        if (!points) return;
+        size_t n = points.size();
+        auto vertices = points.get_vertices();
+        auto tex_coords = points.get_texture_coordinates();
+
+        auto& vbo = pixel_buffer_api::get();
+        auto& persistent = persistent_buffer_api::get();
+        if (vbo.available && n > _capacity)
+            allocate(n);
+
+        if (_mapped)
+        {
+            // The draw that read this region REGIONS frames ago has to be done with it
+            _region = (_region + 1) % REGIONS;
+            if (_fences[_region])
+            {
+                GLenum status = persistent.client_wait_sync(_fences[_region], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                {
+                    // Still in use (or the wait failed): keep its fence and try the same region next frame
+                    _region = (_region + REGIONS - 1) % REGIONS;
+                    return upload_client(vertices, tex_coords, n);
+                }
+                persistent.delete_sync(_fences[_region]);
+                _fences[_region] = nullptr;
+            }
+            char* base = (char*)_mapped + _region * region_bytes();
+            _count = compact_valid_points(vertices, tex_coords, n, (float*)base, (float*)(base + vertices_bytes()));
+            _offset = _region * region_bytes();
+            _in_client = false;
+        }
+        else if (vbo.available)
+        {
+            vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+            // Orphan the previous storage, a draw still reading it keeps it alive and does not block the map
+            vbo.buffer_data(GL_ARRAY_BUFFER, ptrdiff_t(region_bytes()), nullptr, GL_STREAM_DRAW);
+            if (char* base = (char*)vbo.map_buffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY))
+            {
+                _count = compact_valid_points(vertices, tex_coords, n, (float*)base, (float*)(base + vertices_bytes()));
+                vbo.unmap_buffer(GL_ARRAY_BUFFER);
+                _offset = 0;
+                _in_client = false;
+            }
+            vbo.bind_buffer(GL_ARRAY_BUFFER, 0);
+        }
+        else
+            upload_client(vertices, tex_coords, n);
+    }
+
+    // Draws the uploaded points as GL_POINTS with the current matrices, texture and point size
+    void draw()
+    {
+        if (!_count) return;
+        auto& vbo = pixel_buffer_api::get();
+        const char* base = nullptr;
+        bool from_buffer = !_in_client;
+        if (from_buffer)
+        {
+            vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+            base = reinterpret_cast<const char*>(_offset); // offset into the bound buffer
+        }
+        else
+            base = (const char*)_client.data();
+
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, base);
+        glTexCoordPointer(2, GL_FLOAT, 0, base + (from_buffer ? vertices_bytes() : _count * 3 * sizeof(float)));
+        glDrawArrays(GL_POINTS, 0, GLsizei(_count));
+        glPopClientAttrib();
+
+        if (from_buffer)
+        {
+            vbo.bind_buffer(GL_ARRAY_BUFFER, 0);
+            if (_mapped)
+                _fences[_region] = persistent_buffer_api::get().fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    // Points uploaded by the last upload()
+    size_t size() const { return _count; }
+
+private:
+    size_t vertices_bytes() const { return _capacity * 3 * sizeof(float); }
+    size_t region_bytes() const { return _capacity * 5 * sizeof(float); }
+
+    // Storage for clouds of up to points points, a new buffer object since persistent storage is immutable
+    void allocate(size_t points)
+    {
+        auto& vbo = pixel_buffer_api::get();
+        auto& persistent = persistent_buffer_api::get();
+        for (auto& fence : _fences)
+        {
+            if (fence) persistent.delete_sync(fence);
+            fence = nullptr;
+        }
+        if (_buffer)
+        {
+            vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+            if (_mapped) vbo.unmap_buffer(GL_ARRAY_BUFFER);
+            vbo.bind_buffer(GL_ARRAY_BUFFER, 0);
+            vbo.delete_buffers(1, &_buffer);
+        }
+        _mapped = nullptr;
+        _capacity = points;
+        vbo.gen_buffers(1, &_buffer);
+        if (persistent.available)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+            persistent.buffer_storage(GL_ARRAY_BUFFER, ptrdiff_t(REGIONS * region_bytes()), nullptr, flags);
+            _mapped = persistent.map_buffer_range(GL_ARRAY_BUFFER, 0, ptrdiff_t(REGIONS * region_bytes()), flags);
+            vbo.bind_buffer(GL_ARRAY_BUFFER, 0);
+            if (!_mapped)
+            {
+                // The storage is immutable, upload() orphans a buffer of its own instead
+                vbo.delete_buffers(1, &_buffer);
+                vbo.gen_buffers(1, &_buffer);
+            }
+        }
+    }
+
+    void upload_client(const rs2::vertex* vertices, const rs2::texture_coordinate* tex_coords, size_t n)
+    {
+        _client.resize(n * 5);
+        _count = compact_valid_points(vertices, tex_coords, n, _client.data(), _client.data() + n * 3);
+        // draw() expects the texture coordinates right after the kept vertices
+        std::memmove(_client.data() + _count * 3, _client.data() + n * 3, _count * 2 * sizeof(float));
+        _in_client = true;
+    }
+
+    GLuint _buffer = 0;
+    size_t _capacity = 0;           // points per region
+    void* _mapped = nullptr;        // all regions, while persistently mapped
+    void* _fences[REGIONS] = {};
+    int _region = 0;
+    size_t _offset = 0;             // of the region the last upload() went to
+    size_t _count = 0;
+    std::vector<float> _client;     // compacted points when they are not in the buffer
+    bool _in_client = false;        // the last upload() went to _client
+};
+
+#ifndef GL_DYNAMIC_DRAW
+#define GL_DYNAMIC_DRAW 0x88E8
+#endif
+
+/// \brief A trajectory of bounded size for long runs, simplified as the samples come in and kept in a vertex
+/// buffer that only ever grows at the end.
+/// Samples are simplified with an opening window (the online form of Douglas-Peucker): the last kept point is the
+/// anchor, and a sample is dropped as long as every sample since the anchor stays within tolerance of the segment
+/// from the anchor to the newest one. The newest sample is always drawn, so the line reaches the camera.
+/// Once capacity points are kept, every other point is dropped, so the older part of a long run gets coarser while
+/// the memory and the cost of a frame stay constant however long it lasts: per sample, at most WINDOW distances are
+/// computed, and per frame only the newly kept points are copied to the GPU
+class trajectory_buffer
+{
+public:
+    // Samples checked against a candidate segment at most, a straight run longer than that keeps a point
+    static const size_t WINDOW = 64;
+
+    // tolerance in meters
+    explicit trajectory_buffer(float tolerance = 0.005f, size_t capacity = 8192)
+        : _tolerance(tolerance), _capacity(std::max<size_t>(capacity, 4))
+    {
+        _points.reserve(_capacity + 1); // + 1 for the newest sample while drawing from client memory
+        _pending.reserve(WINDOW);
+    }
+
+    void add(const rs2_vector& p)
+    {
+        if (_points.empty())
+        {
+            _points.push_back(p);
+            return;
+        }
+        bool fits = _pending.size() < WINDOW;
+        for (size_t i = 0; fits && i < _pending.size(); i++)
+            fits = distance_to_segment(_pending[i], _points.back(), p) <= _tolerance;
+        if (!fits)
+        {
+            // the previous sample ends the segment and becomes the anchor
+            keep(_pending.back());
+            _pending.clear();
+        }
+        _pending.push_back(p);
+    }
+
+    void clear()
+    {
+        _points.clear();
+        _pending.clear();
+        _uploaded = 0;
+    }
+
+    // Points drawn: the kept ones and the newest sample
+    size_t size() const { return _points.size() + (_pending.empty() ? 0 : 1); }
+
+    // Draws the trajectory as a line strip with the current matrices, color and line width
+    void draw()
+    {
+        if (size() < 2) return;
+        auto& vbo = pixel_buffer_api::get();
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        if (vbo.available)
+        {
+            if (!_buffer)
+            {
+                vbo.gen_buffers(1, &_buffer);
+                vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+                vbo.buffer_data(GL_ARRAY_BUFFER, ptrdiff_t((_capacity + 1) * sizeof(rs2_vector)), nullptr, GL_DYNAMIC_DRAW);
+                _uploaded = 0;
+            }
+            else
+                vbo.bind_buffer(GL_ARRAY_BUFFER, _buffer);
+            // Only the points kept since the last frame, and the newest sample right after them
+            if (_uploaded < _points.size())
+                vbo.buffer_sub_data(GL_ARRAY_BUFFER, ptrdiff_t(_uploaded * sizeof(rs2_vector)),
+                    ptrdiff_t((_points.size() - _uploaded) * sizeof(rs2_vector)), &_points[_uploaded]);
+            _uploaded = _points.size();
+            if (!_pending.empty())
+                vbo.buffer_sub_data(GL_ARRAY_BUFFER, ptrdiff_t(_points.size() * sizeof(rs2_vector)), ptrdiff_t(sizeof(rs2_vector)), &_pending.back());
+            glVertexPointer(3, GL_FLOAT, 0, nullptr);
+            glDrawArrays(GL_LINE_STRIP, 0, GLsizei(size()));
+            vbo.bind_buffer(GL_ARRAY_BUFFER, 0);
+        }
+        else
+        {
+            // the reserved slot after the kept points takes the newest sample, nothing is reallocated
+            if (!_pending.empty()) _points.push_back(_pending.back());
+            glVertexPointer(3, GL_FLOAT, 0, _points.data());
+            glDrawArrays(GL_LINE_STRIP, 0, GLsizei(_points.size()));
+            if (!_pending.empty()) _points.pop_back();
+        }
+        glPopClientAttrib();
+    }
+
+private:
+    static float distance_to_segment(const rs2_vector& p, const rs2_vector& a, const rs2_vector& b)
+    {
+        float abx = b.x - a.x, aby = b.y - a.y, abz = b.z - a.z;
+        float apx = p.x - a.x, apy = p.y - a.y, apz = p.z - a.z;
+        float length2 = abx * abx + aby * aby + abz * abz;
+        float t = length2 > 0 ? std::min(1.f, std::max(0.f, (apx * abx + apy * aby + apz * abz) / length2)) : 0.f;
+        float dx = apx - t * abx, dy = apy - t * aby, dz = apz - t * abz;
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    void keep(const rs2_vector& p)
+    {
+        if (_points.size() == _capacity)
+        {
+            // Thin out: every other point, the first and the last stay. The buffer is rewritten at the next draw
+            size_t last = _points.size() - 1;
+            size_t n = 0;
+            for (size_t i = 0; i < last; i += 2)
+                _points[n++] = _points[i];
+            _points[n++] = _points[last];
+            _points.resize(n);
+            _uploaded = 0;
+        }
+        _points.push_back(p);
+    }
+
+    const float _tolerance;
+    size_t _capacity;
+    std::vector<rs2_vector> _points;  // kept, the last one is the anchor
+    std::vector<rs2_vector> _pending; // samples since the anchor, the last one is the newest
+    GLuint _buffer = 0;
+    size_t _uploaded = 0;             // kept points already in _buffer
+};
+
 // Struct for managing rotation of pointcloud view
 struct glfw_state {
     glfw_state(float yaw = 15.0, float pitch = 15.0) : yaw(yaw), pitch(pitch), last_x(0.0), last_y(0.0),
@@ -936,6 +1502,7 @@ struct glfw_state {
     float offset_x;
     float offset_y;
     texture tex;
+    point_cloud_buffer cloud;
 };
 
 // Handles all the OpenGL calls needed to display the point cloud
@@ -972,24 +1539,12 @@ void draw_pointcloud(float width, float height, glfw_state& app_state, rs2::poin
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, tex_border_color);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F); // GL_CLAMP_TO_EDGE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F); // GL_CLAMP_TO_EDGE
-    glBegin(GL_POINTS);
-
 
-    /* this segment actually prints the pointcloud */
-    auto vertices = points.get_vertices();              // get vertices
-    auto tex_coords = points.get_texture_coordinates(); // and texture coordinates
-    for (int i = 0; i < points.size(); i++)
-    {
-        if (vertices[i].z)
-        {
-            // upload the point and texture coordinates only for points we have depth data for
-            glVertex3fv(vertices[i]);
-            glTexCoord2fv(tex_coords[i]);
-        }
-    }
+    /* this segment actually prints the pointcloud: the points we have depth data for, in one draw call */
+    app_state.cloud.upload(points);
+    app_state.cloud.draw();
 
     // OpenGL cleanup
-    glEnd();
     glPopMatrix();
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
@@ -1005,7 +1560,7 @@ void quat2mat(rs2_quaternion& q, GLfloat H[16])  // to column-major matrix
 }
 
 // Handles all the OpenGL calls needed to display the point cloud w.r.t. static reference frame
-void draw_pointcloud_wrt_world(float width, float height, glfw_state& app_state, rs2::points& points, rs2_pose& pose, float H_t265_d400[16], std::vector<rs2_vector>& trajectory)
+void draw_pointcloud_wrt_world(float width, float height, glfw_state& app_state, rs2::points& points, rs2_pose& pose, float H_t265_d400[16], trajectory_buffer& trajectory)
 {
     if (!points)
         return;
@@ -1035,13 +1590,8 @@ void draw_pointcloud_wrt_world(float width, float height, glfw_state& app_state,
     // draw trajectory
     glEnable(GL_DEPTH_TEST);
     glLineWidth(2.0f);
-    glBegin(GL_LINE_STRIP);
-    for (auto&& v : trajectory)
-    {
-        glColor3f(0.0f, 1.0f, 0.0f);
-        glVertex3f(v.x, v.y, v.z);
-    }
-    glEnd();
+    glColor3f(0.0f, 1.0f, 0.0f);
+    trajectory.draw();
     glLineWidth(0.5f);
     glColor3f(1.0f, 1.0f, 1.0f);
 
@@ -1066,23 +1616,12 @@ void draw_pointcloud_wrt_world(float width, float height, glfw_state& app_state,
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, tex_border_color);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F); // GL_CLAMP_TO_EDGE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F); // GL_CLAMP_TO_EDGE
-    glBegin(GL_POINTS);
 
-    /* this segment actually prints the pointcloud */
-    auto vertices = points.get_vertices();              // get vertices
-    auto tex_coords = points.get_texture_coordinates(); // and texture coordinates
-    for (int i = 0; i < points.size(); i++)
-    {
-        if (vertices[i].z)
-        {
-            // upload the point and texture coordinates only for points we have depth data for
-            glVertex3fv(vertices[i]);
-            glTexCoord2fv(tex_coords[i]);
-        }
-    }
+    /* this segment actually prints the pointcloud: the points we have depth data for, in one draw call */
+    app_state.cloud.upload(points);
+    app_state.cloud.draw();
 
     // OpenGL cleanup
-    glEnd();
     glPopMatrix();
     glMatrixMode(GL_PROJECTION);
     glPopMatrix();
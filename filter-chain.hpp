@@ -0,0 +1,408 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+//////////////////////////////
+// Depth post-processing    //
+//////////////////////////////
+
+/// \brief Picks the depth decimation magnitude from the measured per-frame processing time.
+/// The cost is smoothed with an exponential moving average and compared against a time budget:
+/// above the budget the magnitude goes up (1 = decimation off, then 2, 3, ...), below
+/// LOWER_RATIO * budget it goes back down. The gap between the two thresholds and a settle period
+/// after every change provide the hysteresis that keeps the magnitude from oscillating.
+class decimation_controller
+{
+public:
+    // Magnitude goes up once the average exceeds the budget, down once it falls under this fraction of it.
+    // Halving the magnitude roughly quadruples the depth pixel count, 0.5 leaves room for that
+    static constexpr double LOWER_RATIO = 0.5;
+    // Frames to wait after a change before the next decision, lets the average settle on the new cost
+    static const int SETTLE_FRAMES = 30;
+
+    explicit decimation_controller(double budget_ms = 0.0, int max_magnitude = 4)
+        : _budget_ms(budget_ms), _max_magnitude(std::max(1, std::min(max_magnitude, 8))) {}
+
+    // A budget of 0 disables the controller and keeps decimation off
+    void set_budget(double budget_ms) { _budget_ms = budget_ms; }
+    double budget() const { return _budget_ms; }
+    bool active() const { return _budget_ms > 0; }
+
+    // Fixed magnitude for as long as no budget is set (benchmarks)
+    void set_magnitude(int m) { _magnitude.store(std::max(1, std::min(m, _max_magnitude)), std::memory_order_relaxed); }
+
+    // 1 means no decimation. Safe to read from any thread
+    int magnitude() const { return _magnitude.load(std::memory_order_relaxed); }
+    double average_ms() const { return _average_ms.load(std::memory_order_relaxed); }
+
+    // Feed the processing time of one frame, called from a single thread
+    void update(double frame_ms)
+    {
+        if (!active()) return;
+
+        auto avg = _samples ? _average_ms.load(std::memory_order_relaxed) * 0.9 + frame_ms * 0.1 : frame_ms;
+        _average_ms.store(avg, std::memory_order_relaxed);
+        _samples++;
+        if (_samples < SETTLE_FRAMES) return;
+
+        auto m = magnitude();
+        if (avg > _budget_ms && m < _max_magnitude)
+            change(m + 1);
+        else if (avg < _budget_ms * LOWER_RATIO && m > 1)
+            change(m - 1);
+    }
+
+private:
+    void change(int m)
+    {
+        _magnitude.store(m, std::memory_order_relaxed);
+        _samples = 0; // restart the average from the cost at the new magnitude
+    }
+
+    double _budget_ms;
+    int _max_magnitude;
+    int _samples = 0;
+    std::atomic<int> _magnitude{ 1 };
+    std::atomic<double> _average_ms{ 0.0 };
+};
+
+/// \brief The post-processing chain shared by the demos:
+/// align -> decimation -> disparity -> spatial -> temporal -> depth -> colorizer.
+/// The colorizer step is left out when nothing displays the depth (headless runs).
+/// Every step is timed so the cost of each filter can be inspected while the application runs.
+/// Decimation is skipped unless a processing-time budget is set, then decimation_controller
+/// adjusts its magnitude to keep the per-frame cost within the budget.
+class post_processing_chain
+{
+public:
+    // Colorizer is used to visualize depth data
+    rs2::colorizer color_map;
+    // Decimation filter reduces the amount of data (while preserving best samples)
+    rs2::decimation_filter dec;
+    // Define transformations from and to Disparity domain
+    rs2::disparity_transform depth2disparity;
+    rs2::disparity_transform disparity2depth{ false };
+    // Define spatial filter (edge-preserving)
+    rs2::spatial_filter spat;
+    // Define temporal filter
+    rs2::temporal_filter temp;
+    // Spatially align all streams to the requested viewport
+    rs2::align align_to;
+    // Adaptive decimation, off until a budget is set
+    decimation_controller decimation;
+
+    explicit post_processing_chain(rs2_stream align_target, bool colorize = true)
+        : align_to(align_target)
+    {
+        // Use black to white color map
+        color_map.set_option(RS2_OPTION_COLOR_SCHEME, 2.f);
+        // If the demo is too slow, make sure you run in Release (-DCMAKE_BUILD_TYPE=Release)
+        // but you can also increase the following parameter to decimate depth more (reducing quality)
+        dec.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2);
+        // Enable hole-filling
+        // Hole filling is an agressive heuristic and it gets the depth wrong many times
+        // However, this demo is not built to handle holes
+        // (the shortest-path will always prefer to "cut" through the holes since they have zero 3D distance)
+        spat.set_option(RS2_OPTION_HOLES_FILL, 5); // 5 = fill all the zero pixels
+
+        // First make the frames spatially aligned
+        add_step("align", align_to);
+        // Decimation will reduce the resultion of the depth image,
+        // closing small holes and speeding-up the algorithm
+        add_step("decimation", [this](const rs2::frameset& data) -> rs2::frameset {
+            auto m = decimation.magnitude();
+            if (m <= 1) return data;
+            // Changed on the thread running the filter, so it never races with processing
+            if (m != _applied_magnitude)
+            {
+                dec.set_option(RS2_OPTION_FILTER_MAGNITUDE, float(m));
+                _applied_magnitude = m;
+            }
+            return data.apply_filter(dec);
+        });
+        // To make sure far-away objects are filtered proportionally
+        // we try to switch to disparity domain
+        add_step("disparity", depth2disparity);
+        // Apply spatial filtering
+        add_step("spatial", spat);
+        // Apply temporal filtering
+        add_step("temporal", temp);
+        // If we are in disparity domain, switch back to depth
+        add_step("depth", disparity2depth);
+        // Apply color map for visualization of depth
+        if (colorize)
+            add_step("colorizer", color_map);
+    }
+
+    post_processing_chain(const post_processing_chain&) = delete;
+    post_processing_chain& operator=(const post_processing_chain&) = delete;
+
+    size_t size() const { return _steps.size(); }
+    const std::string& step_name(size_t i) const { return _steps[i]->name; }
+
+    // Runs a single step, has to be called in order for every frameset
+    rs2::frameset apply_step(size_t i, const rs2::frameset& data)
+    {
+        auto& step = *_steps[i];
+        auto start = std::chrono::steady_clock::now();
+        rs2::frameset result = step.apply(data);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        step.frames.fetch_add(1, std::memory_order_relaxed);
+        step.total_us.fetch_add(us, std::memory_order_relaxed);
+        step.last_us.store(us, std::memory_order_relaxed);
+        if (us > step.max_us.load(std::memory_order_relaxed))
+            step.max_us.store(us, std::memory_order_relaxed);
+        if (_on_step_done)
+            _on_step_done(i, result, start);
+        return result;
+    }
+
+    // Called on the processing thread with the output of every step and the time the step started
+    // (to stamp latencies, record trace spans). Has to be set before any frame is processed
+    using step_callback = std::function<void(size_t, const rs2::frameset&, std::chrono::steady_clock::time_point)>;
+    void on_step_done(step_callback callback) { _on_step_done = std::move(callback); }
+
+    // Runs all steps one after another on the calling thread
+    rs2::frameset process(rs2::frameset data)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < _steps.size(); i++)
+            data = apply_step(i, data);
+        decimation.update(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        return data;
+    }
+
+    // Cost of the given steps for the most recent frame that went through them, in milliseconds
+    double last_ms(size_t first, size_t last) const
+    {
+        long long us = 0;
+        for (size_t i = first; i < last; i++)
+            us += _steps[i]->last_us.load(std::memory_order_relaxed);
+        return us / 1000.0;
+    }
+
+    // Average cost of a step so far, in milliseconds
+    double average_ms(size_t i) const
+    {
+        auto frames = _steps[i]->frames.load(std::memory_order_relaxed);
+        return frames ? _steps[i]->total_us.load(std::memory_order_relaxed) / 1000.0 / frames : 0.0;
+    }
+
+    void report(std::ostream& out) const
+    {
+        out << "Post-processing cost per step:" << std::endl;
+        for (size_t i = 0; i < _steps.size(); i++)
+        {
+            out << "  " << std::left << std::setw(12) << _steps[i]->name << std::right
+                << std::fixed << std::setprecision(2) << average_ms(i) << " ms avg, "
+                << _steps[i]->max_us.load() / 1000.0 << " ms max, "
+                << _steps[i]->frames.load() << " frames" << std::endl;
+        }
+        if (decimation.active())
+            out << "  decimation budget " << decimation.budget() << " ms, final magnitude " << decimation.magnitude() << std::endl;
+    }
+
+private:
+    struct step
+    {
+        std::string name;
+        std::function<rs2::frameset(const rs2::frameset&)> apply;
+        std::atomic<long long> frames{ 0 };
+        std::atomic<long long> last_us{ 0 };
+        std::atomic<long long> total_us{ 0 };
+        std::atomic<long long> max_us{ 0 };
+    };
+
+    void add_step(const char* name, rs2::filter& f)
+    {
+        add_step(name, [&f](const rs2::frameset& data) -> rs2::frameset { return data.apply_filter(f); });
+    }
+
+    void add_step(const char* name, std::function<rs2::frameset(const rs2::frameset&)> apply)
+    {
+        _steps.emplace_back(new step());
+        _steps.back()->name = name;
+        _steps.back()->apply = std::move(apply);
+    }
+
+    std::vector<std::unique_ptr<step>> _steps;
+    step_callback _on_step_done;
+    int _applied_magnitude = 2;
+};
+
+/// \brief Fixed-capacity FIFO connecting two pipeline stages.
+/// push blocks while the queue is full (back-pressure), pop blocks while it is empty.
+/// Both give up once the queue is closed.
+template<class T>
+class bounded_queue
+{
+public:
+    explicit bounded_queue(size_t capacity) : _capacity(std::max<size_t>(capacity, 1)) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [&] { return _closed || _items.size() < _capacity; });
+        if (_closed) return false;
+        _items.push_back(std::move(item));
+        lock.unlock();
+        _not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [&] { return _closed || !_items.empty(); });
+        if (_items.empty()) return false;
+        item = std::move(_items.front());
+        _items.pop_front();
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _not_full.notify_all();
+        _not_empty.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _items.size();
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _not_full, _not_empty;
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _closed = false;
+};
+
+/// \brief Runs the steps of a post_processing_chain as a pipeline, one worker thread per stage.
+/// Consecutive steps are grouped into stages (e.g. {2, 2, 2, 1} runs align+decimation |
+/// disparity+spatial | temporal+depth | colorizer on four threads). Stages are connected by bounded queues, so a frame
+/// is handed to the next stage as soon as its current stage is done and throughput scales with cores.
+/// Every stage is a single thread reading from a FIFO, which keeps the frame order intact
+/// (the temporal filter relies on it).
+/// With adaptive decimation the controller is fed the cost of the slowest stage,
+/// which is what limits the frame rate of a pipeline.
+class pipelined_chain
+{
+public:
+    pipelined_chain(post_processing_chain& chain, std::vector<size_t> stage_sizes,
+        std::function<void(rs2::frameset)> output, size_t queue_capacity = 2)
+        : _chain(chain), _output(std::move(output))
+    {
+        size_t first = 0;
+        for (auto count : stage_sizes)
+        {
+            if (!count || first >= chain.size()) continue;
+            _stages.push_back({ first, std::min(first + count, chain.size()) });
+            first = _stages.back().second;
+        }
+        // Any steps not covered by stage_sizes form the last stage
+        if (first < chain.size())
+            _stages.push_back({ first, chain.size() });
+
+        for (size_t i = 0; i < _stages.size(); i++)
+            _queues.emplace_back(new bounded_queue<rs2::frameset>(queue_capacity));
+        for (size_t i = 0; i < _stages.size(); i++)
+            _workers.emplace_back([this, i] { run_stage(i); });
+    }
+
+    ~pipelined_chain() { stop(); }
+
+    // Feeds a frameset into the first stage, blocks while that stage is saturated
+    bool push(const rs2::frameset& data)
+    {
+        return !_queues.empty() && _queues.front()->push(data);
+    }
+
+    // Closes the queues and waits for the workers. Frames still in flight are discarded
+    void stop()
+    {
+        for (auto& q : _queues) q->close();
+        for (auto& t : _workers)
+            if (t.joinable()) t.join();
+    }
+
+    // Lets every frame already pushed run through all stages, then stops the workers (end of a recording)
+    void finish()
+    {
+        for (size_t s = 0; s < _workers.size(); s++)
+        {
+            _queues[s]->close(); // a closed queue still hands out what it holds
+            if (_workers[s].joinable()) _workers[s].join();
+        }
+    }
+
+    size_t stages() const { return _stages.size(); }
+
+    void report(std::ostream& out) const
+    {
+        out << "Pipelined post-processing, " << _stages.size() << " stages:" << std::endl;
+        for (size_t s = 0; s < _stages.size(); s++)
+        {
+            double stage_ms = 0;
+            out << "  stage " << s << " [";
+            for (size_t i = _stages[s].first; i < _stages[s].second; i++)
+            {
+                out << (i == _stages[s].first ? "" : " + ") << _chain.step_name(i);
+                stage_ms += _chain.average_ms(i);
+            }
+            out << "] " << std::fixed << std::setprecision(2) << stage_ms << " ms avg" << std::endl;
+        }
+    }
+
+private:
+    void run_stage(size_t s)
+    {
+        rs2::frameset data;
+        while (_queues[s]->pop(data))
+        {
+            for (size_t i = _stages[s].first; i < _stages[s].second; i++)
+                data = _chain.apply_step(i, data);
+
+            if (s + 1 < _stages.size())
+            {
+                if (!_queues[s + 1]->push(data)) break;
+            }
+            else
+            {
+                double bottleneck_ms = 0;
+                for (auto& stage : _stages)
+                    bottleneck_ms = std::max(bottleneck_ms, _chain.last_ms(stage.first, stage.second));
+                _chain.decimation.update(bottleneck_ms);
+                _output(data);
+            }
+        }
+    }
+
+    post_processing_chain& _chain;
+    std::function<void(rs2::frameset)> _output;
+    std::vector<std::pair<size_t, size_t>> _stages; // [first, last) step of each stage
+    std::vector<std::unique_ptr<bounded_queue<rs2::frameset>>> _queues;
+    std::vector<std::thread> _workers;
+};
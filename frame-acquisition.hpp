@@ -0,0 +1,302 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include "synthetic-scene.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//////////////////////////////
+// Frame acquisition        //
+//////////////////////////////
+
+// How long the processing thread blocks waiting for a frameset before it re-checks its alive flag.
+// Bounds shutdown time without waking the thread up between frames.
+const unsigned int ACQUISITION_TIMEOUT_MS = 100;
+
+// Returns true if the given flag was passed on the command line
+inline bool has_flag(int argc, char* argv[], const char* flag)
+{
+    for (int i = 1; i < argc; i++)
+        if (std::strcmp(argv[i], flag) == 0)
+            return true;
+    return false;
+}
+
+// Returns the argument following the given flag, or nullptr if the flag was not passed
+inline const char* flag_value(int argc, char* argv[], const char* flag)
+{
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::strcmp(argv[i], flag) == 0)
+            return argv[i + 1];
+    return nullptr;
+}
+
+// Splits a comma separated flag value, "a,b,c"
+inline std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+// CPU time consumed by the calling thread, in milliseconds
+inline double thread_cpu_time_ms()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0.0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;   u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) / 10000.0; // 100 ns units
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0.0;
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
+}
+
+// Milliseconds elapsed between the frame's timestamp and now.
+// Only meaningful when the timestamp is expressed in host time (system / global time domains),
+// returns a negative value otherwise.
+inline double frame_age_ms(const rs2::frame& f)
+{
+    auto domain = f.get_frame_timestamp_domain();
+    if (domain != RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME && domain != RS2_TIMESTAMP_DOMAIN_GLOBAL_TIME)
+        return -1.0;
+    auto now = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return now - f.get_timestamp();
+}
+
+/// \brief Measures the CPU load of the thread that owns it together with the frame latency it adds.
+/// Used to compare blocking acquisition against polling: an idle thread should show close to 0% CPU
+/// while the sensor-to-output latency stays the same.
+class acquisition_meter
+{
+public:
+    explicit acquisition_meter(const char* name)
+        : _name(name), _start_wall(std::chrono::steady_clock::now()), _start_cpu(thread_cpu_time_ms()) {}
+
+    // Call once per frameset after it has been handed over to the consumer
+    void frame_done(const rs2::frame& f)
+    {
+        _frames++;
+        auto age = frame_age_ms(f);
+        if (age < 0) return;
+        _latency_frames++;
+        _latency_sum += age;
+        _latency_max = std::max(_latency_max, age);
+    }
+
+    // Must be called from the measured thread
+    void report(std::ostream& out) const
+    {
+        auto wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start_wall).count();
+        auto cpu = thread_cpu_time_ms() - _start_cpu;
+        out << _name << ": " << _frames << " frames in " << std::fixed << std::setprecision(1) << wall / 1000.0 << " s"
+            << ", CPU " << (wall > 0 ? 100.0 * cpu / wall : 0.0) << "% of one core";
+        if (_latency_frames)
+            out << ", latency avg " << _latency_sum / _latency_frames << " ms, max " << _latency_max << " ms";
+        else
+            out << ", latency n/a (timestamps not in host time domain)";
+        out << std::endl;
+    }
+
+private:
+    const char* _name;
+    std::chrono::steady_clock::time_point _start_wall;
+    double _start_cpu;
+    unsigned long long _frames = 0;
+    unsigned long long _latency_frames = 0;
+    double _latency_sum = 0.0;
+    double _latency_max = 0.0;
+};
+
+/// \brief Command-line selection of where the frames come from
+struct source_options
+{
+    std::string playback_file; // --playback <file.bag>: replay a recording instead of a live camera
+    bool real_time = false;    // --real-time: replay at the recorded pace instead of as fast as processing allows
+    bool synthetic = false;    // --synthetic WxH@fps: render a moving sphere instead of using a camera
+    synthetic_settings scene;  // --sphere-color R,G,B and --sphere-radius <m> adjust the synthetic scene
+
+    bool playback() const { return !playback_file.empty(); }
+    bool live() const { return !playback() && !synthetic; }
+};
+
+inline source_options parse_source_options(int argc, char* argv[])
+{
+    source_options opts;
+    if (auto file = flag_value(argc, argv, "--playback"))
+        opts.playback_file = file;
+    opts.real_time = has_flag(argc, argv, "--real-time");
+
+    if (auto mode = flag_value(argc, argv, "--synthetic"))
+    {
+        if (!parse_synthetic_mode(mode, opts.scene))
+            throw std::runtime_error("--synthetic expects WIDTHxHEIGHT@FPS, e.g. 848x480@90");
+        opts.synthetic = true;
+    }
+    if (auto color = flag_value(argc, argv, "--sphere-color"))
+        if (!parse_rgb(color, opts.scene.sphere_color))
+            throw std::runtime_error("--sphere-color expects R,G,B in 0..255");
+    if (auto radius = flag_value(argc, argv, "--sphere-radius"))
+        opts.scene.sphere_radius = float(std::atof(radius));
+
+    if (opts.synthetic && opts.playback())
+        throw std::runtime_error("--synthetic and --playback can not be combined");
+    return opts;
+}
+
+/// \brief rs2::pipeline fed either by a live device or by a recorded .bag file, or the synthetic scene.
+/// A recording is replayed with set_real_time(false) by default: the file is read only as fast as the
+/// frames are consumed, so every frame goes through processing exactly once and a run is repeatable
+/// regardless of how fast the host is. Together with lockstep() on the consumer side this gives
+/// deterministic, faster-than-real-time reprocessing of field recordings on machines without a camera.
+/// The synthetic scene bypasses the pipeline: its software device delivers framesets through its own syncer.
+class frame_source
+{
+public:
+    explicit frame_source(const source_options& opts) : _opts(opts) {}
+
+    // configure_live_streams is only called for a live device, a recording is replayed with the
+    // streams it contains
+    void start(std::function<void(rs2::config&)> configure_live_streams)
+    {
+        if (_opts.synthetic)
+        {
+            _synthetic.reset(new synthetic_scene(_opts.scene));
+            _synthetic->start();
+            return;
+        }
+
+        rs2::config cfg;
+        if (_opts.playback())
+            cfg.enable_device_from_file(_opts.playback_file, false); // play once, finished() reports the end
+        else
+            configure_live_streams(cfg);
+
+        _profile = _pipe.start(cfg);
+        _streaming = true;
+
+        if (_opts.playback())
+        {
+            _playback.reset(new rs2::playback(_profile.get_device()));
+            _playback->set_real_time(_opts.real_time);
+        }
+    }
+
+    // Stops streaming, frames the consumer has kept stay valid
+    void stop()
+    {
+        if (_synthetic)
+            _synthetic->stop();
+        else if (_streaming)
+            _pipe.stop();
+        _streaming = false;
+    }
+
+    bool is_playback() const { return _opts.playback(); }
+    bool is_live() const { return _opts.live(); }
+
+    // The scene that renders the frames, nullptr unless running on synthetic frames
+    const synthetic_scene* synthetic() const { return _synthetic.get(); }
+
+    // When true, consumers should take every frame instead of keeping only the newest one
+    bool lockstep() const { return _opts.playback() && !_opts.real_time; }
+
+    // Blocks for the next frameset, returns false on timeout
+    bool wait(rs2::frameset& data, unsigned int timeout_ms = ACQUISITION_TIMEOUT_MS)
+    {
+        if (_synthetic)
+            return _synthetic->wait(data, timeout_ms);
+        return _pipe.try_wait_for_frames(&data, timeout_ms);
+    }
+
+    bool poll(rs2::frameset& data)
+    {
+        if (_synthetic)
+            return _synthetic->poll(data);
+        return _pipe.poll_for_frames(&data);
+    }
+
+    // True once a recording has been played to the end, never for a live device
+    bool finished() const
+    {
+        return _playback && _playback->current_status() == RS2_PLAYBACK_STATUS_STOPPED;
+    }
+
+    rs2::device get_device() const
+    {
+        return _synthetic ? _synthetic->get_device() : _profile.get_device();
+    }
+
+    rs2::stream_profile get_stream(rs2_stream type) const
+    {
+        return _synthetic ? _synthetic->get_stream(type) : _profile.get_stream(type);
+    }
+
+private:
+    source_options _opts;
+    rs2::pipeline _pipe;
+    rs2::pipeline_profile _profile;
+    std::unique_ptr<rs2::playback> _playback;
+    std::unique_ptr<synthetic_scene> _synthetic;
+    bool _streaming = false;
+};
+
+// Reads up to count framesets from a recording or the synthetic scene and keeps them in memory (benchmarks).
+// Stops early at the end of a recording
+inline std::vector<rs2::frameset> load_framesets(const source_options& opts, size_t count)
+{
+    frame_source source(opts);
+    source.start([](rs2::config&) {});
+
+    std::vector<rs2::frameset> frames;
+    int timeouts = 0;
+    while (frames.size() < count)
+    {
+        rs2::frameset data;
+        if (source.wait(data, 1000))
+        {
+            data.keep();
+            frames.push_back(data);
+            timeouts = 0;
+        }
+        else if (source.finished() || ++timeouts == 5)
+            break;
+    }
+    source.stop();
+    if (frames.empty())
+        throw std::runtime_error("No frames could be loaded");
+    return frames;
+}
@@ -0,0 +1,330 @@
+#include "glad.h" // before anything that may include gl.h
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "gl-renderer.hpp"
+#include "../third-party/stb_easy_font.h"
+
+#include <string>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    const char* VERTEX_SHADER = R"(#version 330 core
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texcoord;
+layout(location = 2) in vec4 color;
+uniform vec2 viewport;
+out vec2 uv;
+out vec4 tint;
+void main()
+{
+    uv = texcoord;
+    tint = color;
+    gl_Position = vec4(position.x * 2.0 / viewport.x - 1.0, 1.0 - position.y * 2.0 / viewport.y, 0.0, 1.0);
+}
+)";
+
+    const char* FRAGMENT_SHADER = R"(#version 330 core
+in vec2 uv;
+in vec4 tint;
+uniform sampler2D image;
+out vec4 fragment;
+void main()
+{
+    fragment = texture(image, uv) * tint;
+}
+)";
+
+    // Vertices a frame usually needs, the queues grow past it once and keep their storage
+    const size_t RESERVED_VERTICES = 1024;
+
+    // stb_easy_font output is about 270 bytes per character, this leaves room for the densest glyphs
+    const size_t TEXT_BYTES_PER_CHAR = 1024;
+
+    // Layout of the vertices stb_easy_font_print writes, four per quad
+    struct stb_vertex
+    {
+        float x, y, z;
+        uint8_t color[4];
+    };
+
+    GLuint compile(GLenum type, const char* source)
+    {
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &source, nullptr);
+        glCompileShader(shader);
+        GLint ok = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if (!ok)
+        {
+            char log[1024] = {};
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            glDeleteShader(shader);
+            throw std::runtime_error(std::string("Overlay shader does not compile: ") + log);
+        }
+        return shader;
+    }
+
+    uint8_t to_byte(float v)
+    {
+        return uint8_t(std::lround(std::min(std::max(v, 0.f), 1.f) * 255.f));
+    }
+}
+
+gl_renderer::gl_renderer()
+{
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        throw std::runtime_error("Could not load the OpenGL functions, is the window's context current?");
+    if (!GLAD_GL_VERSION_3_3)
+        throw std::runtime_error("The renderer requires OpenGL 3.3, the context is " +
+            std::to_string(GLVersion.major) + "." + std::to_string(GLVersion.minor));
+
+    GLuint vertex_shader = compile(GL_VERTEX_SHADER, VERTEX_SHADER);
+    GLuint fragment_shader = compile(GL_FRAGMENT_SHADER, FRAGMENT_SHADER);
+    _program = glCreateProgram();
+    glAttachShader(_program, vertex_shader);
+    glAttachShader(_program, fragment_shader);
+    glLinkProgram(_program);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(_program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        glDeleteProgram(_program);
+        throw std::runtime_error("Overlay shaders do not link");
+    }
+    _viewport_location = glGetUniformLocation(_program, "viewport");
+
+    GLint previous_program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+    glUseProgram(_program);
+    glUniform1i(glGetUniformLocation(_program, "image"), 0);
+    glUseProgram(GLuint(previous_program));
+
+    // The attribute layout is recorded once in the vertex array object
+    GLint previous_array_buffer = 0;
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous_array_buffer);
+    glGenVertexArrays(1, &_vertex_array);
+    glGenBuffers(1, &_vertex_buffer);
+    glBindVertexArray(_vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (const void*)offsetof(vertex, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (const void*)offsetof(vertex, u));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(vertex), (const void*)offsetof(vertex, rgba));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, GLuint(previous_array_buffer));
+
+    GLint previous_texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+    const uint8_t white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &_white);
+    glBindTexture(GL_TEXTURE_2D, _white);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, GLuint(previous_texture));
+
+    _vertices.reserve(RESERVED_VERTICES);
+    _batches.reserve(16);
+    _text_cache.resize(TEXT_CACHE);
+}
+
+gl_renderer::~gl_renderer()
+{
+    glDeleteTextures(1, &_white);
+    glDeleteBuffers(1, &_vertex_buffer);
+    glDeleteVertexArrays(1, &_vertex_array);
+    glDeleteProgram(_program);
+}
+
+void gl_renderer::begin(float width, float height)
+{
+    _width = width > 0 ? width : 1.f;
+    _height = height > 0 ? height : 1.f;
+    _frame++;
+    _vertices.clear();
+    _batches.clear();
+}
+
+void gl_renderer::image(unsigned texture, float x, float y, float w, float h, float alpha)
+{
+    if (!texture)
+        return;
+    const float corners[4][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } };
+    quad(texture, corners, 0.f, 0.f, 1.f, 1.f, { 1.f, 1.f, 1.f, alpha });
+}
+
+void gl_renderer::fill_rect(float x, float y, float w, float h, const color& c)
+{
+    const float corners[4][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } };
+    quad(_white, corners, 0.f, 0.f, 0.f, 0.f, c);
+}
+
+void gl_renderer::line(float x0, float y0, float x1, float y1, float width, const color& c)
+{
+    float dx = x1 - x0, dy = y1 - y0;
+    float length = std::sqrt(dx * dx + dy * dy);
+    if (length <= 0.f)
+        return;
+    // Half the width along the normal of the segment
+    float nx = -dy / length * width * 0.5f;
+    float ny = dx / length * width * 0.5f;
+    const float corners[4][2] = { { x0 + nx, y0 + ny }, { x1 + nx, y1 + ny }, { x1 - nx, y1 - ny }, { x0 - nx, y0 - ny } };
+    quad(_white, corners, 0.f, 0.f, 0.f, 0.f, c);
+}
+
+void gl_renderer::cross(float x, float y, float half_size, float width, const color& c)
+{
+    line(x - half_size, y, x + half_size, y, width, c);
+    line(x, y - half_size, x, y + half_size, width, c);
+}
+
+void gl_renderer::text(float x, float y, const char* text, const color& c)
+{
+    auto& geometry = text_geometry(text);
+    if (geometry.empty())
+        return;
+    const uint8_t rgba[4] = { to_byte(c.r), to_byte(c.g), to_byte(c.b), to_byte(c.a) };
+    auto& b = batch_for(_white);
+    for (auto v : geometry)
+    {
+        v.x += x;
+        v.y += y - 7.f; // the baseline, as draw_text places it
+        std::memcpy(v.rgba, rgba, sizeof(rgba));
+        _vertices.push_back(v);
+    }
+    b.count += int(geometry.size());
+}
+
+const std::vector<gl_renderer::vertex>& gl_renderer::text_geometry(const char* text)
+{
+    for (auto& entry : _text_cache)
+    {
+        if (entry.text == text)
+        {
+            entry.last_used = _frame;
+            return entry.geometry;
+        }
+    }
+
+    // Replaces the least recently used string, its storage is reused
+    auto& entry = *std::min_element(_text_cache.begin(), _text_cache.end(),
+        [](const text_entry& a, const text_entry& b) { return a.last_used < b.last_used; });
+    entry.text.assign(text);
+    entry.last_used = _frame;
+    entry.geometry.clear();
+
+    auto needed = (entry.text.size() + 1) * TEXT_BYTES_PER_CHAR;
+    if (_text_output.size() < needed)
+        _text_output.resize(needed);
+    int quads = stb_easy_font_print(0.f, 0.f, &entry.text[0], nullptr, _text_output.data(), int(_text_output.size()));
+
+    const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    vertex v = {};
+    for (int q = 0; q < quads; q++)
+    {
+        stb_vertex corners[4];
+        std::memcpy(corners, _text_output.data() + q * sizeof(corners), sizeof(corners));
+        for (int i : order)
+        {
+            v.x = corners[i].x;
+            v.y = corners[i].y;
+            entry.geometry.push_back(v);
+        }
+    }
+    return entry.geometry;
+}
+
+gl_renderer::batch& gl_renderer::batch_for(unsigned texture)
+{
+    if (_batches.empty() || _batches.back().texture != texture)
+        _batches.push_back({ texture, int(_vertices.size()), 0 });
+    return _batches.back();
+}
+
+// Two triangles, corners in order around the quad. (u0, v0) maps to the first corner, (u1, v1) to the third
+void gl_renderer::quad(unsigned texture, const float (&corners)[4][2], float u0, float v0, float u1, float v1, const color& c)
+{
+    const float uv[4][2] = { { u0, v0 }, { u1, v0 }, { u1, v1 }, { u0, v1 } };
+    const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    vertex v;
+    v.rgba[0] = to_byte(c.r);
+    v.rgba[1] = to_byte(c.g);
+    v.rgba[2] = to_byte(c.b);
+    v.rgba[3] = to_byte(c.a);
+
+    auto& b = batch_for(texture);
+    for (int i : order)
+    {
+        v.x = corners[i][0];
+        v.y = corners[i][1];
+        v.u = uv[i][0];
+        v.v = uv[i][1];
+        _vertices.push_back(v);
+    }
+    b.count += 6;
+}
+
+void gl_renderer::flush()
+{
+    _draw_calls = 0;
+    if (_vertices.empty())
+        return;
+
+    // Fixed-function and binding state the legacy drawing relies on, restored below
+    GLint program, vertex_array, array_buffer, texture, active_texture, blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertex_array);
+    glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &array_buffer);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blend_src_rgb);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blend_dst_rgb);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blend_src_alpha);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blend_dst_alpha);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    glUseProgram(_program);
+    glUniform2f(_viewport_location, _width, _height);
+    glBindVertexArray(_vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+
+    // The storage is orphaned on every flush, the driver hands out fresh memory instead of waiting for the
+    // draws of the previous flush to finish reading it
+    size_t bytes = _vertices.size() * sizeof(vertex);
+    if (bytes > _buffer_capacity)
+        _buffer_capacity = std::max(bytes, RESERVED_VERTICES * sizeof(vertex));
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(_buffer_capacity), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(bytes), _vertices.data());
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    for (auto& b : _batches)
+    {
+        glBindTexture(GL_TEXTURE_2D, b.texture);
+        glDrawArrays(GL_TRIANGLES, b.first, b.count);
+        _draw_calls++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, GLuint(texture));
+    glActiveTexture(GLenum(active_texture));
+    glBlendFuncSeparate(GLenum(blend_src_rgb), GLenum(blend_dst_rgb), GLenum(blend_src_alpha), GLenum(blend_dst_alpha));
+    if (!blend)
+        glDisable(GL_BLEND);
+    glBindBuffer(GL_ARRAY_BUFFER, GLuint(array_buffer));
+    glBindVertexArray(GLuint(vertex_array));
+    glUseProgram(GLuint(program));
+
+    _vertices.clear();
+    _batches.clear();
+}
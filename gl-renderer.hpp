@@ -0,0 +1,154 @@
+#pragma once
+
+// No OpenGL headers here: gl-renderer.cpp loads the OpenGL 3.3 functions through glad, whose header can
+// not share a translation unit with the system gl.h that example.hpp includes through GLFW
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#include <algorithm>
+
+//////////////////////////////
+// Retained-mode renderer   //
+//////////////////////////////
+
+/// \brief Fixed-capacity text for labels rebuilt every frame, formatted in place without touching the heap.
+/// Longer text is cut at Capacity - 1 characters
+template<size_t Capacity>
+class fixed_text
+{
+public:
+    fixed_text(const char* text = "") { format("%s", text); }
+
+    // Replaces the text, printf-style
+    void format(const char* fmt, ...)
+    {
+        _size = 0;
+        _text[0] = 0;
+        va_list args;
+        va_start(args, fmt);
+        vappend(fmt, args);
+        va_end(args);
+    }
+
+    void append(const char* fmt, ...)
+    {
+        va_list args;
+        va_start(args, fmt);
+        vappend(fmt, args);
+        va_end(args);
+    }
+
+    const char* c_str() const { return _text; }
+    size_t size() const { return _size; }
+
+private:
+    void vappend(const char* fmt, va_list args)
+    {
+        int n = std::vsnprintf(_text + _size, Capacity - _size, fmt, args);
+        if (n > 0)
+            _size = std::min(Capacity - 1, _size + size_t(n));
+    }
+
+    char _text[Capacity];
+    size_t _size = 0;
+};
+
+/// \brief Draws the 2D part of a frame (stream images, HUD panels, crosshairs, axis lines, text) with one small shader
+/// program and one vertex buffer instead of glBegin/glEnd.
+/// Shapes are queued in window coordinates (origin at the top left, like the projection window sets up) and
+/// turned into triangles on the CPU. flush() uploads all of them with a single buffer update and issues one draw
+/// call per run of shapes that use the same texture: every untextured shape of a frame shares one draw call, each
+/// stream image takes one. Shapes are drawn in the order they were queued, alpha blended.
+/// Text is turned into triangles by stb_easy_font once per distinct string: the geometry of the last TEXT_CACHE
+/// strings is kept, so a label that did not change is only copied into the frame. Once the queues and the cache
+/// have grown to what a frame needs, nothing is allocated any more.
+/// Needs the window's context current on the calling thread and OpenGL 3.3 or newer (any compatibility context
+/// GLFW creates by default qualifies on current drivers); the fixed-function state is left as flush() found it,
+/// so legacy drawing can still be mixed in between two flushes.
+class gl_renderer
+{
+public:
+    // Distinct strings whose geometry is kept
+    static const size_t TEXT_CACHE = 32;
+
+    struct color
+    {
+        float r, g, b, a;
+    };
+
+    // Loads OpenGL and builds the program and buffers in the current context, throws std::runtime_error if the
+    // context is older than 3.3
+    gl_renderer();
+    ~gl_renderer();
+
+    gl_renderer(const gl_renderer&) = delete;
+    gl_renderer& operator=(const gl_renderer&) = delete;
+
+    // Starts a frame over a window of width x height (window coordinates, not framebuffer pixels), drops anything
+    // queued and not flushed
+    void begin(float width, float height);
+
+    // Texture (a GL texture name, e.g. texture::get_gl_handle()) stretched over the rectangle
+    void image(unsigned texture, float x, float y, float w, float h, float alpha = 1.f);
+    void fill_rect(float x, float y, float w, float h, const color& c);
+    // Segment drawn as a quad width pixels wide, wide lines are not available in core profiles
+    void line(float x0, float y0, float x1, float y1, float width, const color& c);
+    // Horizontal and vertical segments through (x, y), half_size pixels each way
+    void cross(float x, float y, float half_size, float width, const color& c);
+    // Same placement as draw_text: (x, y) is the left end of the first line's baseline, '\n' starts a new line
+    void text(float x, float y, const char* text, const color& c);
+
+    // Draws everything queued since begin() or the previous flush()
+    void flush();
+
+    // Draw calls issued by the last flush(), to check the batching
+    size_t draw_calls() const { return _draw_calls; }
+
+private:
+    struct vertex
+    {
+        float x, y;
+        float u, v;
+        uint8_t rgba[4];
+    };
+
+    // Vertices [first, first + count) all sample the same texture
+    struct batch
+    {
+        unsigned texture;
+        int first;
+        int count;
+    };
+
+    struct text_entry
+    {
+        std::string text;
+        std::vector<vertex> geometry; // drawn at (0, 0), two triangles per stb_easy_font quad
+        unsigned long long last_used = 0;
+    };
+
+    // The batch new vertices with this texture go to
+    batch& batch_for(unsigned texture);
+    void quad(unsigned texture, const float (&corners)[4][2], float u0, float v0, float u1, float v1, const color& c);
+    const std::vector<vertex>& text_geometry(const char* text);
+
+    unsigned _program = 0;
+    unsigned _vertex_array = 0;
+    unsigned _vertex_buffer = 0;
+    unsigned _white = 0;          // 1x1 texture sampled by the untextured shapes
+    int _viewport_location = -1;
+    size_t _buffer_capacity = 0;  // bytes of storage in _vertex_buffer
+
+    float _width = 1.f;
+    float _height = 1.f;
+    std::vector<vertex> _vertices;
+    std::vector<batch> _batches;
+    size_t _draw_calls = 0;
+
+    std::vector<text_entry> _text_cache;
+    std::vector<char> _text_output;   // stb_easy_font writes its quads here
+    unsigned long long _frame = 0;    // counts begin() calls, for the least recently used string
+};
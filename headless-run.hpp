@@ -0,0 +1,246 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include "frame-acquisition.hpp" // has_flag, flag_value
+#include "tracking-output.hpp"   // tracked_point
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <algorithm>
+
+//////////////////////////////
+// Unattended runs          //
+//////////////////////////////
+
+/// \brief The command line, extended with the settings of a key = value file given with --config <file>.
+/// Keys are flag names without the dashes, a key without a value (or set to true) is a plain flag, false leaves it
+/// out, '#' starts a comment:
+///
+///     headless
+///     playback = line-3.bag
+///     click = 640,360
+///     output = results.csv
+///
+/// The file's settings are appended to the command line as the flags they name. flag_value returns the first
+/// occurrence, so a flag given on the command line wins over the file, and every existing flag can be set either way.
+class run_config
+{
+public:
+    run_config(int argc, char* argv[])
+    {
+        for (int i = 0; i < argc; i++)
+            _args.push_back(argv[i]);
+        if (auto path = flag_value(argc, argv, "--config"))
+            load(path);
+        for (auto& a : _args)
+            _argv.push_back(&a[0]);
+        _argv.push_back(nullptr);
+    }
+
+    run_config(const run_config&) = delete;
+    run_config& operator=(const run_config&) = delete;
+
+    int argc() const { return int(_args.size()); }
+    char** argv() { return _argv.data(); }
+
+private:
+    static std::string trim(const std::string& s)
+    {
+        auto begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) return "";
+        return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    void load(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Can not read config file " + path);
+        std::string line;
+        int number = 0;
+        while (std::getline(file, line))
+        {
+            number++;
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty())
+                continue;
+            auto equals = line.find('=');
+            auto key = trim(line.substr(0, equals));
+            auto value = equals == std::string::npos ? std::string("true") : trim(line.substr(equals + 1));
+            if (key.empty() || value.empty())
+                throw std::runtime_error(path + ":" + std::to_string(number) + ": expected key = value");
+            if (value == "false")
+                continue;
+            _args.push_back("--" + key);
+            if (value != "true")
+                _args.push_back(value);
+        }
+    }
+
+    std::vector<std::string> _args;
+    std::vector<char*> _argv;
+};
+
+// Set by Ctrl+C / SIGTERM
+inline volatile std::sig_atomic_t& stop_signal()
+{
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+}
+
+inline void on_stop_signal(int) { stop_signal() = 1; }
+
+/// \brief When an unattended run ends: at the end of a recording (checked by the caller), after --duration <s>,
+/// or on Ctrl+C / SIGTERM, which let the run shut down and write its reports instead of killing it
+class run_limit
+{
+public:
+    run_limit(int argc, char* argv[])
+    {
+        std::signal(SIGINT, on_stop_signal);
+        std::signal(SIGTERM, on_stop_signal);
+        if (auto value = flag_value(argc, argv, "--duration"))
+        {
+            _deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds((long long)(std::atof(value) * 1000.0));
+            _has_deadline = true;
+        }
+    }
+
+    bool reached() const
+    {
+        return stop_signal() != 0 || (_has_deadline && std::chrono::steady_clock::now() >= _deadline);
+    }
+
+private:
+    std::chrono::steady_clock::time_point _deadline;
+    bool _has_deadline = false;
+};
+
+/// \brief Machine-readable results, one record per line: JSON Lines, or CSV when the file name ends in .csv
+/// ("-" writes JSON Lines to stdout). Every record has to add the same fields in the same order, the CSV header
+/// is taken from the first one. Records are formatted into a fixed line buffer and written through a 1 MB file
+/// buffer, so writing does not allocate after the first record.
+class result_sink
+{
+public:
+    explicit result_sink(const std::string& path)
+        : _path(path), _file_buffer(1 << 20)
+    {
+        _csv = path.size() > 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        if (path == "-")
+        {
+            _out = &std::cout;
+            return;
+        }
+        _file.open(path, std::ios::out | std::ios::trunc);
+        if (!_file)
+            throw std::runtime_error("Can not write results to " + path);
+        // the 1 MB buffer, set once the file is open (MSVC drops it otherwise)
+        _file.rdbuf()->pubsetbuf(_file_buffer.data(), std::streamsize(_file_buffer.size()));
+        _out = &_file;
+    }
+
+    ~result_sink() { flush(); }
+
+    result_sink(const result_sink&) = delete;
+    result_sink& operator=(const result_sink&) = delete;
+
+    result_sink& field(const char* name, double value) { return put(name, "%.6f", value); }
+    result_sink& field(const char* name, float value) { return put(name, "%.6f", double(value)); }
+    result_sink& field(const char* name, int value) { return put(name, "%d", value); }
+    result_sink& field(const char* name, unsigned long long value) { return put(name, "%llu", value); }
+    result_sink& field(const char* name, bool value)
+    {
+        if (_csv) return put(name, "%d", int(value));
+        return put(name, "%s", value ? "true" : "false");
+    }
+    // Identifiers and enum names, no escaping is done
+    result_sink& field(const char* name, const char* value) { return put(name, _csv ? "%s" : "\"%s\"", value); }
+
+    void end_record()
+    {
+        if (_records == 0 && _csv)
+            *_out << _header << '\n';
+        if (!_csv)
+            append("}");
+        _line[_used++] = '\n';
+        _out->write(_line, std::streamsize(_used));
+        _used = 0;
+        _fields = 0;
+        _records++;
+    }
+
+    void flush() { _out->flush(); }
+
+    // Reports meant for people go to stderr then, so that stdout stays machine-readable
+    bool to_stdout() const { return _out == &std::cout; }
+
+    void report(std::ostream& out) const
+    {
+        out << "Results: " << _records << " records written to " << (_path == "-" ? "stdout" : _path) << std::endl;
+    }
+
+private:
+    template<class... T>
+    result_sink& put(const char* name, const char* format, T... value)
+    {
+        if (_records == 0 && _csv)
+            _header += (_fields ? "," : "") + std::string(name);
+        if (_csv)
+            append(_fields ? "," : "");
+        else
+            append(_fields ? ",\"%s\":" : "{\"%s\":", name);
+        append(format, value...);
+        _fields++;
+        return *this;
+    }
+
+    template<class... T>
+    void append(const char* format, T... value)
+    {
+        // one character is kept for the newline
+        int n = std::snprintf(_line + _used, sizeof(_line) - 1 - _used, format, value...);
+        if (n > 0)
+            _used = std::min(sizeof(_line) - 2, _used + size_t(n));
+    }
+
+    void append(const char* text) { append("%s", text); }
+
+    std::string _path;
+    std::vector<char> _file_buffer;
+    std::ofstream _file;
+    std::ostream* _out = nullptr;
+    bool _csv = false;
+    std::string _header;
+    char _line[2048];
+    size_t _used = 0;
+    size_t _fields = 0;
+    unsigned long long _records = 0;
+};
+
+// One tracking result as a record
+inline void write_tracked_point(result_sink& sink, const tracked_point& p)
+{
+    sink.field("frame", p.frame_number)
+        .field("timestamp", p.timestamp)
+        .field("domain", rs2_timestamp_domain_to_string(p.domain))
+        .field("valid", p.valid)
+        .field("u", p.pixel[0]).field("v", p.pixel[1])
+        .field("x", p.camera[0]).field("y", p.camera[1]).field("z", p.camera[2])
+        .field("robot_x", p.robot[0]).field("robot_y", p.robot[1]).field("robot_z", p.robot[2]);
+    sink.end_record();
+}
+
+// Parses "X,Y" into a pixel, returns false if the text is not two integers
+inline bool parse_pixel(const char* text, std::pair<int, int>& pixel)
+{
+    return text && std::sscanf(text, "%d,%d", &pixel.first, &pixel.second) == 2;
+}
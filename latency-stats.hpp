@@ -0,0 +1,260 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include "frame-acquisition.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+//////////////////////////////
+// Latency statistics       //
+//////////////////////////////
+
+// Monotonic time in microseconds, every latency stamp is taken with this clock
+inline long long monotonic_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline long long monotonic_us(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+/// \brief Rolling latency histogram, filled by a single thread and readable from any other.
+/// Buckets are log-linear, 8 per power of two from 1 us up to 16 s (within 12.5% of the value), so add() is a
+/// few integer operations and one relaxed increment, with no locks and no allocation.
+/// Samples go to one of two windows of WINDOW_US that take turns: percentiles cover the current and the
+/// previous window, so anything older than two windows is forgotten.
+class latency_histogram
+{
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAX_BITS = 24;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB;
+    static const long long WINDOW_US = 5000000;
+
+    latency_histogram()
+    {
+        for (auto& w : _windows)
+        {
+            w.epoch.store(-2, std::memory_order_relaxed);
+            for (auto& b : w.buckets) b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Writer side
+    void add(long long us, long long now_us)
+    {
+        auto epoch = now_us / WINDOW_US;
+        auto& w = _windows[epoch & 1];
+        if (w.epoch.load(std::memory_order_relaxed) != epoch)
+        {
+            // This window holds samples from two windows ago (or older), start it over
+            for (auto& b : w.buckets) b.store(0, std::memory_order_relaxed);
+            w.epoch.store(epoch, std::memory_order_release);
+        }
+        w.buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Reader side. Samples in the last two windows and the given percentiles of them (p in [0, 1]), in ms
+    unsigned long long percentiles(long long now_us, const double* p, double* ms, size_t count) const
+    {
+        unsigned long long buckets[BUCKETS] = {};
+        unsigned long long total = 0;
+        auto epoch = now_us / WINDOW_US;
+        for (auto& w : _windows)
+        {
+            if (epoch - w.epoch.load(std::memory_order_acquire) > 1)
+                continue;
+            for (int i = 0; i < BUCKETS; i++)
+            {
+                auto n = w.buckets[i].load(std::memory_order_relaxed);
+                buckets[i] += n;
+                total += n;
+            }
+        }
+
+        for (size_t k = 0; k < count; k++)
+        {
+            ms[k] = 0;
+            if (!total) continue;
+            auto rank = std::max<unsigned long long>(1, (unsigned long long)(p[k] * total + 0.999999));
+            unsigned long long seen = 0;
+            for (int i = 0; i < BUCKETS; i++)
+            {
+                seen += buckets[i];
+                if (seen >= rank)
+                {
+                    ms[k] = middle(i) / 1000.0;
+                    break;
+                }
+            }
+        }
+        return total;
+    }
+
+private:
+    static int bucket(long long us)
+    {
+        if (us < SUB) return us < 0 ? 0 : int(us);
+        us = std::min(us, (1LL << MAX_BITS) - 1);
+        int e = SUB_BITS;
+        while (us >> (e + 1)) e++;
+        return (e - SUB_BITS + 1) * SUB + int((us >> (e - SUB_BITS)) & (SUB - 1));
+    }
+
+    // Value in the middle of a bucket, us
+    static double middle(int i)
+    {
+        if (i < SUB) return i;
+        int e = i / SUB + SUB_BITS - 1;
+        long long width = 1LL << (e - SUB_BITS);
+        return double((SUB + i % SUB) * width) + (width - 1) / 2.0;
+    }
+
+    struct window
+    {
+        std::atomic<long long> epoch;
+        std::atomic<unsigned long long> buckets[BUCKETS];
+    };
+    window _windows[2];
+};
+
+/// \brief Latency of every stage a frame goes through, measured from the moment the camera captured it.
+/// The acquiring thread records the origin of each frameset with begin(): the frame timestamp converted to the
+/// monotonic clock when it is in host time (system / global time domains), otherwise the time of acquisition.
+/// Any thread can then stamp() a stage for that frame, keyed by the color frame number, which the
+/// post-processing filters keep. Every stage is a rolling latency_histogram of "origin to end of this stage",
+/// so the difference between consecutive stages is where the time goes.
+/// Each stage has to be stamped from one thread at a time, all stages have to be added before frames flow.
+class latency_stats
+{
+public:
+    // Origins of the frames in flight, a frame is forgotten this many framesets after it was acquired
+    static const size_t TIMELINE = 256;
+
+    latency_stats()
+    {
+        for (auto& s : _timeline)
+        {
+            s.frame.store(NO_FRAME, std::memory_order_relaxed);
+            s.origin_us.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    latency_stats(const latency_stats&) = delete;
+    latency_stats& operator=(const latency_stats&) = delete;
+
+    // Returns the index to stamp the stage with, stages are reported in the order they were added
+    size_t add_stage(const std::string& name)
+    {
+        _stages.emplace_back(new stage());
+        _stages.back()->name = name;
+        return _stages.size() - 1;
+    }
+
+    size_t stages() const { return _stages.size(); }
+
+    // Frames of one frameset are identified by the number of the color frame
+    static unsigned long long frame_key(const rs2::frameset& frames)
+    {
+        auto color = frames.get_color_frame();
+        return color ? color.get_frame_number() : frames.get_frame_number();
+    }
+
+    // Records the origin of a freshly acquired frameset. If its timestamp is in host time the given stage
+    // receives the sensor-to-acquisition latency
+    void begin(const rs2::frameset& frames, size_t acquisition_stage)
+    {
+        auto now = monotonic_us();
+        auto origin = now;
+        auto color = frames.get_color_frame();
+        auto age = frame_age_ms(color ? rs2::frame(color) : rs2::frame(frames));
+        if (age >= 0)
+        {
+            origin = now - (long long)(age * 1000.0);
+            _stages[acquisition_stage]->histogram.add(now - origin, now);
+            _host_time.store(true, std::memory_order_relaxed);
+        }
+
+        auto key = frame_key(frames);
+        auto& slot = _timeline[key % TIMELINE];
+        slot.frame.store(NO_FRAME, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.origin_us.store(origin, std::memory_order_relaxed);
+        slot.frame.store(key, std::memory_order_release);
+    }
+
+    // Records that the frame has just been through the given stage. Frames begin() never saw are ignored
+    void stamp(size_t stage, unsigned long long frame)
+    {
+        long long origin;
+        if (!find_origin(frame, origin))
+            return;
+        auto now = monotonic_us();
+        _stages[stage]->histogram.add(now - origin, now);
+    }
+
+    // Can be called from any thread at any time
+    void report(std::ostream& out) const
+    {
+        const double p[3] = { 0.5, 0.95, 0.99 };
+        auto now = monotonic_us();
+        out << "Latency per stage over the last " << 2 * latency_histogram::WINDOW_US / 1000000 << " s, "
+            << (_host_time.load(std::memory_order_relaxed) ? "from the sensor timestamp" : "from acquisition (timestamps not in host time domain)")
+            << ":" << std::endl;
+        double previous_p50 = 0;
+        for (auto& s : _stages)
+        {
+            double ms[3];
+            auto samples = s->histogram.percentiles(now, p, ms, 3);
+            out << "  " << std::left << std::setw(14) << s->name << std::right;
+            if (!samples)
+            {
+                out << "no samples" << std::endl;
+                continue;
+            }
+            out << std::fixed << std::setprecision(2) << "p50 " << ms[0] << " ms (+" << std::max(0.0, ms[0] - previous_p50)
+                << "), p95 " << ms[1] << " ms, p99 " << ms[2] << " ms, " << samples << " frames" << std::endl;
+            previous_p50 = ms[0];
+        }
+    }
+
+private:
+    bool find_origin(unsigned long long frame, long long& origin) const
+    {
+        auto& slot = _timeline[frame % TIMELINE];
+        if (slot.frame.load(std::memory_order_acquire) != frame)
+            return false;
+        origin = slot.origin_us.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // begin() may have replaced the slot meanwhile
+        return slot.frame.load(std::memory_order_relaxed) == frame;
+    }
+
+    static const unsigned long long NO_FRAME = ~0ULL;
+
+    struct stage
+    {
+        std::string name;
+        latency_histogram histogram;
+    };
+
+    struct origin_slot
+    {
+        std::atomic<unsigned long long> frame;
+        std::atomic<long long> origin_us;
+    };
+
+    std::vector<std::unique_ptr<stage>> _stages;
+    origin_slot _timeline[TIMELINE];
+    std::atomic<bool> _host_time{ false };
+};
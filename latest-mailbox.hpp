@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+//////////////////////////////
+// Latest-wins handoff      //
+//////////////////////////////
+
+/// \brief Single-producer / single-consumer "latest wins" mailbox (triple buffer).
+/// The producer never blocks and never waits for the consumer: publishing overwrites whatever
+/// the consumer has not picked up yet, and every overwritten item is counted as dropped.
+/// The consumer always receives the newest item together with its sequence number,
+/// so latency stays bounded by one item instead of growing into a backlog.
+/// Either side may also block until the other one catches up (wait_take / wait_taken); the
+/// condition variable behind that is only touched while somebody is actually waiting.
+template<class T>
+class latest_mailbox
+{
+public:
+    // Producer side. Returns false if an unconsumed item had to be dropped to make room
+    bool publish(T item)
+    {
+        auto seq = _published.load(std::memory_order_relaxed) + 1;
+        _slots[_back].item = std::move(item);
+        _slots[_back].sequence = seq;
+        _published.store(seq, std::memory_order_relaxed);
+
+        auto prev = _middle.exchange(_back | FRESH);
+        _back = prev & INDEX_MASK;
+        notify_waiters();
+        if (prev & FRESH)
+        {
+            // The consumer never saw this one, release it right away (frames go back to their pool)
+            _slots[_back].item = T();
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Producer side. Blocks until the consumer has taken the last published item (lockstep mode,
+    // nothing gets dropped) or the timeout expires. Returns true if the item was taken
+    template<class Rep, class Period>
+    bool wait_taken(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        return wait_for([this] { return !(_middle.load() & FRESH); }, timeout);
+    }
+
+    // Consumer side. Moves the newest item into out if anything was published since the last take,
+    // otherwise leaves out untouched and returns false
+    bool try_take(T& out, unsigned long long* sequence = nullptr)
+    {
+        if (!(_middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+
+        auto prev = _middle.exchange(_front);
+        _front = prev & INDEX_MASK;
+        out = std::move(_slots[_front].item);
+        _slots[_front].item = T();
+        if (sequence) *sequence = _slots[_front].sequence;
+        _consumed.fetch_add(1, std::memory_order_relaxed);
+        notify_waiters();
+        return true;
+    }
+
+    // Consumer side. Like try_take, but blocks up to timeout for something new to be published
+    template<class Rep, class Period>
+    bool wait_take(T& out, unsigned long long* sequence, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if (try_take(out, sequence))
+            return true;
+        wait_for([this] { return (_middle.load() & FRESH) != 0; }, timeout);
+        return try_take(out, sequence);
+    }
+
+    // Counters can be read from any thread
+    unsigned long long published() const { return _published.load(std::memory_order_relaxed); }
+    unsigned long long consumed() const { return _consumed.load(std::memory_order_relaxed); }
+    unsigned long long dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    // The waiter count and the FRESH flag are both accessed sequentially consistent, so either the
+    // notifying side sees the waiter or the waiting side sees the change before it goes to sleep
+    void notify_waiters()
+    {
+        if (!_waiters.load())
+            return;
+        { std::lock_guard<std::mutex> lock(_wait_mutex); }
+        _wait_cv.notify_all();
+    }
+
+    template<class Pred, class Rep, class Period>
+    bool wait_for(Pred pred, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        _waiters.fetch_add(1);
+        bool result;
+        {
+            std::unique_lock<std::mutex> lock(_wait_mutex);
+            result = _wait_cv.wait_for(lock, timeout, pred);
+        }
+        _waiters.fetch_sub(1);
+        return result;
+    }
+
+    static const unsigned INDEX_MASK = 0x3;
+    static const unsigned FRESH = 0x4;  // set while the middle slot holds an item the consumer has not taken
+
+    struct slot
+    {
+        T item;
+        unsigned long long sequence = 0;
+    };
+
+    slot _slots[3];
+    unsigned _back = 0;                 // owned by the producer
+    std::atomic<unsigned> _middle{ 1 }; // shared, index | FRESH
+    unsigned _front = 2;                // owned by the consumer
+
+    std::atomic<unsigned long long> _published{ 0 };
+    std::atomic<unsigned long long> _consumed{ 0 };
+    std::atomic<unsigned long long> _dropped{ 0 };
+
+    std::atomic<int> _waiters{ 0 };
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cv;
+};
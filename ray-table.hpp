@@ -0,0 +1,174 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RAY_TABLE_SSE2 1
+#endif
+
+//////////////////////////////
+// Deprojection             //
+//////////////////////////////
+
+/// \brief The ray through every pixel of a stream at unit depth, so that deprojecting a pixel is a multiply by its
+/// depth instead of rs2_deproject_pixel_to_point, which inverts the distortion model on every call.
+/// The table is built once per set of intrinsics (each decimation level has its own); update() reads the frame's
+/// intrinsics, which is cheap next to a frame, and only rebuilds when they differ. Stream profiles are not a key:
+/// decimation and align create new ones and free the old, so a new profile may sit at a freed one's address.
+/// Rays are stored as two planes (x, then y, z is 1), which the batch deprojection reads 8 pixels at a time
+class ray_table
+{
+public:
+    // Rebuilds the table if the frame comes with other intrinsics than the ones it was built for
+    void update(const rs2::video_frame& frame)
+    {
+        update(frame.get_profile().as<rs2::video_stream_profile>().get_intrinsics());
+    }
+
+    void update(const rs2_intrinsics& intr)
+    {
+        if (_rays_x.size() && same(intr, _intrinsics))
+            return;
+        _intrinsics = intr;
+        size_t n = size_t(intr.width) * intr.height;
+        _rays_x.resize(n);
+        _rays_y.resize(n);
+        for (int y = 0; y < intr.height; y++)
+        {
+            for (int x = 0; x < intr.width; x++)
+            {
+                float pixel[2] = { float(x), float(y) };
+                float ray[3];
+                rs2_deproject_pixel_to_point(ray, &intr, pixel, 1.f);
+                _rays_x[size_t(y) * intr.width + x] = ray[0];
+                _rays_y[size_t(y) * intr.width + x] = ray[1];
+            }
+        }
+        _builds++;
+    }
+
+    const rs2_intrinsics& intrinsics() const { return _intrinsics; }
+    int width() const { return _intrinsics.width; }
+    int height() const { return _intrinsics.height; }
+    // Times the table was built, to check that it is not rebuilt every frame
+    unsigned long long builds() const { return _builds; }
+
+    // Point at integer pixel (x, y) and depth (m)
+    void deproject(int x, int y, float depth, float point[3]) const
+    {
+        size_t i = size_t(y) * _intrinsics.width + x;
+        point[0] = _rays_x[i] * depth;
+        point[1] = _rays_y[i] * depth;
+        point[2] = depth;
+    }
+
+    // Point at a sub-pixel position, same as rs2_deproject_pixel_to_point: the ray is interpolated between the
+    // four pixels around it (exact without distortion, within a fraction of a pixel of the model with it)
+    void deproject(const float pixel[2], float depth, float point[3]) const
+    {
+        float px = std::min(std::max(pixel[0], 0.f), float(_intrinsics.width - 1));
+        float py = std::min(std::max(pixel[1], 0.f), float(_intrinsics.height - 1));
+        int x0 = std::min(int(px), std::max(_intrinsics.width - 2, 0));
+        int y0 = std::min(int(py), std::max(_intrinsics.height - 2, 0));
+        int x1 = std::min(x0 + 1, _intrinsics.width - 1), y1 = std::min(y0 + 1, _intrinsics.height - 1);
+        float fx = px - x0, fy = py - y0;
+        auto lerp = [&](const std::vector<float>& rays) {
+            const float* top = &rays[size_t(y0) * _intrinsics.width];
+            const float* bottom = &rays[size_t(y1) * _intrinsics.width];
+            float t = top[x0] + (top[x1] - top[x0]) * fx;
+            float b = bottom[x0] + (bottom[x1] - bottom[x0]) * fx;
+            return t + (b - t) * fy;
+        };
+        point[0] = lerp(_rays_x) * depth;
+        point[1] = lerp(_rays_y) * depth;
+        point[2] = depth;
+    }
+
+    /// \brief Organized point cloud of the rectangle (x, y, w, h) of a Z16 depth frame the table was built for:
+    /// 3 floats per pixel, row by row, (0, 0, 0) where there is no depth, like rs2::pointcloud's vertices.
+    /// points must hold 3 * w * h floats. Pixels are converted and scaled by the depth units 8 at a time with
+    /// SSE2 (one load of Z16, written out as two groups of 4 points), the pointcloud filter in addition maps
+    /// texture coordinates, allocates a frame and deprojects one pixel at a time through the distortion model
+    void deproject(const rs2::depth_frame& depth, int x, int y, int w, int h, float* points) const
+    {
+        if (depth.get_profile().format() != RS2_FORMAT_Z16)
+            throw std::runtime_error("ray_table::deproject expects Z16 depth");
+        if (depth.get_width() != _intrinsics.width || depth.get_height() != _intrinsics.height)
+            throw std::runtime_error("ray_table::deproject: the table was built for another resolution");
+        if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > _intrinsics.width || y + h > _intrinsics.height)
+            throw std::runtime_error("ray_table::deproject: rectangle out of the frame");
+
+        const float units = depth.get_units();
+        const auto data = static_cast<const uint8_t*>(depth.get_data());
+        const int stride = depth.get_stride_in_bytes();
+        for (int row = y; row < y + h; row++)
+        {
+            auto z16 = reinterpret_cast<const uint16_t*>(data + size_t(row) * stride) + x;
+            const float* rx = &_rays_x[size_t(row) * _intrinsics.width + x];
+            const float* ry = &_rays_y[size_t(row) * _intrinsics.width + x];
+            float* out = points + size_t(row - y) * w * 3;
+            int i = 0;
+#ifdef RAY_TABLE_SSE2
+            const __m128 scale = _mm_set1_ps(units);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 8 <= w; i += 8, out += 24)
+            {
+                __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(z16 + i));
+                __m128 z[2] = {
+                    _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero)), scale),
+                    _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero)), scale) };
+                for (int half = 0; half < 2; half++)
+                {
+                    __m128 px = _mm_mul_ps(_mm_loadu_ps(rx + i + 4 * half), z[half]);
+                    __m128 py = _mm_mul_ps(_mm_loadu_ps(ry + i + 4 * half), z[half]);
+                    __m128 pz = z[half];
+                    // x0 x1 x2 x3 / y0.. / z0.. -> x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+                    __m128 xy_low = _mm_unpacklo_ps(px, py);   // x0 y0 x1 y1
+                    __m128 xy_high = _mm_unpackhi_ps(px, py);  // x2 y2 x3 y3
+                    __m128 zx_low = _mm_shuffle_ps(pz, px, _MM_SHUFFLE(1, 1, 0, 0));   // z0 z0 x1 x1
+                    __m128 yz_1 = _mm_shuffle_ps(py, pz, _MM_SHUFFLE(1, 1, 1, 1));     // y1 y1 z1 z1
+                    __m128 zx_high = _mm_shuffle_ps(pz, px, _MM_SHUFFLE(3, 3, 2, 2));  // z2 z2 x3 x3
+                    __m128 yz_3 = _mm_shuffle_ps(py, pz, _MM_SHUFFLE(3, 3, 3, 3));     // y3 y3 z3 z3
+                    float* o = out + 12 * half;
+                    _mm_storeu_ps(o, _mm_shuffle_ps(xy_low, zx_low, _MM_SHUFFLE(2, 0, 1, 0)));
+                    _mm_storeu_ps(o + 4, _mm_shuffle_ps(yz_1, xy_high, _MM_SHUFFLE(1, 0, 2, 0)));
+                    _mm_storeu_ps(o + 8, _mm_shuffle_ps(zx_high, yz_3, _MM_SHUFFLE(2, 0, 2, 0)));
+                }
+            }
+#endif
+            for (; i < w; i++, out += 3)
+            {
+                float z = z16[i] * units;
+                out[0] = rx[i] * z;
+                out[1] = ry[i] * z;
+                out[2] = z;
+            }
+        }
+    }
+
+    // The whole frame
+    void deproject(const rs2::depth_frame& depth, float* points) const
+    {
+        deproject(depth, 0, 0, depth.get_width(), depth.get_height(), points);
+    }
+
+private:
+    static bool same(const rs2_intrinsics& a, const rs2_intrinsics& b)
+    {
+        return a.width == b.width && a.height == b.height && a.ppx == b.ppx && a.ppy == b.ppy
+            && a.fx == b.fx && a.fy == b.fy && a.model == b.model
+            && std::equal(std::begin(a.coeffs), std::end(a.coeffs), std::begin(b.coeffs));
+    }
+
+    rs2_intrinsics _intrinsics = {};
+    std::vector<float> _rays_x;
+    std::vector<float> _rays_y;
+    unsigned long long _builds = 0;
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+// Shared-memory publication of tracking results to other processes on the same host.
+// Self-contained (no RealSense or OpenCV dependency) so that a controller process can include it
+// on its own and use shared_pose_reader.
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////
+// Shared pose segment      //
+//////////////////////////////
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "the segment's atomics have to be lock-free to be shared between processes");
+
+// Segment name without platform prefix ("/" for shm_open, "Local\" for Windows file mappings)
+const char* const SHARED_POSE_DEFAULT_NAME = "BlobTrackerPose";
+const uint32_t SHARED_POSE_MAGIC = 0x53505442; // "BTPS"
+const uint32_t SHARED_POSE_VERSION = 1;
+const uint32_t SHARED_POSE_HISTORY = 64;
+
+/// \brief One tracking result, fixed-width fields so that any reader can map it
+struct shared_pose_record
+{
+    uint64_t frame_number;
+    double timestamp;          // sensor timestamp of the color frame, ms
+    int32_t timestamp_domain;  // rs2_timestamp_domain
+    int32_t valid;             // 0 while the blob is lost or has no valid depth
+    float pixel[2];            // blob center in color pixels
+    float camera[3];           // camera frame, m
+    float robot[3];            // robot frame, m
+};
+static_assert(sizeof(shared_pose_record) == 56, "shared_pose_record layout is part of the shared-memory format");
+
+/// \brief Layout of the shared-memory segment.
+/// sequence is a seqlock: the writer makes it odd, updates the records and makes it even again, a reader
+/// retries whenever it saw an odd value or the value changed while it was copying.
+struct shared_pose_segment
+{
+    std::atomic<uint32_t> magic; // written last by the writer, the segment is valid once it matches
+    uint32_t version;
+    uint32_t history_size;
+    uint32_t record_size;
+    std::atomic<uint64_t> sequence;
+    uint64_t count;         // results published so far, the newest is history[(count - 1) % history_size]
+    shared_pose_record latest;
+    shared_pose_record history[SHARED_POSE_HISTORY];
+};
+
+/// \brief Maps a named shared-memory segment, created by the writer and opened read-only by readers
+class shared_memory_mapping
+{
+public:
+    shared_memory_mapping(const std::string& name, size_t size, bool create) : _size(size)
+    {
+#ifdef _WIN32
+        _name = "Local\\" + name;
+        if (create)
+            _handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, DWORD(size), _name.c_str());
+        else
+            _handle = OpenFileMappingA(FILE_MAP_READ, FALSE, _name.c_str());
+        if (!_handle)
+            throw std::runtime_error("Can not " + std::string(create ? "create" : "open") + " shared memory " + _name);
+        _data = MapViewOfFile(_handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, size);
+        if (!_data)
+        {
+            CloseHandle(_handle);
+            throw std::runtime_error("Can not map shared memory " + _name);
+        }
+#else
+        _name = "/" + name;
+        _owner = create;
+        int fd = create ? shm_open(_name.c_str(), O_CREAT | O_RDWR, 0644) : shm_open(_name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw std::runtime_error("Can not " + std::string(create ? "create" : "open") + " shared memory " + _name);
+        if (create && ftruncate(fd, off_t(size)) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Can not size shared memory " + _name);
+        }
+        _data = mmap(nullptr, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (_data == MAP_FAILED)
+            throw std::runtime_error("Can not map shared memory " + _name);
+#endif
+    }
+
+    ~shared_memory_mapping()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+        CloseHandle(_handle);
+#else
+        munmap(_data, _size);
+        if (_owner)
+            shm_unlink(_name.c_str());
+#endif
+    }
+
+    shared_memory_mapping(const shared_memory_mapping&) = delete;
+    shared_memory_mapping& operator=(const shared_memory_mapping&) = delete;
+
+    void* data() const { return _data; }
+
+private:
+    std::string _name;
+    size_t _size;
+    void* _data = nullptr;
+#ifdef _WIN32
+    HANDLE _handle = nullptr;
+#else
+    bool _owner = false;
+#endif
+};
+
+/// \brief Writer side, owned by the tracker. publish() is a few stores, no syscalls and no allocation
+class shared_pose_writer
+{
+public:
+    explicit shared_pose_writer(const std::string& name = SHARED_POSE_DEFAULT_NAME)
+        : _mapping(name, sizeof(shared_pose_segment), true),
+          _segment(static_cast<shared_pose_segment*>(_mapping.data()))
+    {
+        _segment->magic.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _segment->version = SHARED_POSE_VERSION;
+        _segment->history_size = SHARED_POSE_HISTORY;
+        _segment->record_size = sizeof(shared_pose_record);
+        _segment->sequence.store(0, std::memory_order_relaxed);
+        _segment->count = 0;
+        std::memset(&_segment->latest, 0, sizeof(_segment->latest));
+        std::atomic_thread_fence(std::memory_order_release);
+        _segment->magic.store(SHARED_POSE_MAGIC, std::memory_order_release);
+    }
+
+    void publish(const shared_pose_record& record)
+    {
+        auto seq = _segment->sequence.load(std::memory_order_relaxed);
+        _segment->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        _segment->latest = record;
+        _segment->history[_segment->count % SHARED_POSE_HISTORY] = record;
+        _segment->count++;
+
+        _segment->sequence.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    shared_memory_mapping _mapping;
+    shared_pose_segment* _segment;
+};
+
+/// \brief Reader side, for the controller process.
+/// Poll has_new() (a few loads from the mapping) and call latest() when it returns true: a new result is
+/// visible as soon as the writer has stored it, without any syscall on either side.
+/// Every read throws std::runtime_error if the segment stays in the middle of an update for MAX_READ_SPINS
+/// attempts: the sequence is left odd only if the tracker died between the two stores of publish(), so the
+/// controller can tell that the tracker is gone instead of spinning forever.
+class shared_pose_reader
+{
+public:
+    // Attempts at a consistent snapshot before the writer is given up on, a few milliseconds of spinning
+    static const int MAX_READ_SPINS = 1000000;
+
+    // Throws if no tracker has created the segment
+    explicit shared_pose_reader(const std::string& name = SHARED_POSE_DEFAULT_NAME)
+        : _mapping(name, sizeof(shared_pose_segment), false),
+          _segment(static_cast<const shared_pose_segment*>(_mapping.data()))
+    {
+        auto magic = _segment->magic.load(std::memory_order_acquire);
+        if (magic != SHARED_POSE_MAGIC || _segment->version != SHARED_POSE_VERSION || _segment->record_size != sizeof(shared_pose_record))
+            throw std::runtime_error("Shared memory " + name + " does not hold tracking results of this version");
+    }
+
+    // Number of results published so far
+    uint64_t count() const
+    {
+        uint64_t result = 0;
+        read([&] { result = _segment->count; });
+        return result;
+    }
+
+    bool has_new(uint64_t last_count) const { return count() != last_count; }
+
+    // Copies the newest result, false if nothing has been published yet. count receives its number (from 1)
+    bool latest(shared_pose_record& out, uint64_t* count = nullptr) const
+    {
+        uint64_t n = 0;
+        read([&] {
+            n = _segment->count;
+            out = _segment->latest;
+        });
+        if (count) *count = n;
+        return n > 0;
+    }
+
+    // Copies the most recent results, oldest first (at most SHARED_POSE_HISTORY)
+    void history(std::vector<shared_pose_record>& out) const
+    {
+        read([&] {
+            uint64_t n = _segment->count;
+            uint64_t kept = std::min<uint64_t>(n, SHARED_POSE_HISTORY);
+            out.resize(size_t(kept));
+            for (uint64_t i = 0; i < kept; i++)
+                out[size_t(i)] = _segment->history[(n - kept + i) % SHARED_POSE_HISTORY];
+        });
+    }
+
+private:
+    // Runs copy until it saw a consistent snapshot. The writer holds the lock for a few hundred
+    // nanoseconds per result, so this spins rather than sleeps, but not forever
+    template<class F>
+    void read(F copy) const
+    {
+        for (int spin = 0; spin < MAX_READ_SPINS; spin++)
+        {
+            auto before = _segment->sequence.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+            copy();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_segment->sequence.load(std::memory_order_relaxed) == before)
+                return;
+        }
+        throw std::runtime_error("Shared pose segment stuck in the middle of an update, the tracker stopped while publishing");
+    }
+
+    shared_memory_mapping _mapping;
+    const shared_pose_segment* _segment;
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+//////////////////////////////
+// Synthetic scene          //
+//////////////////////////////
+
+/// \brief Geometry and timing of the synthetic scene.
+/// Camera coordinates follow the RealSense convention: x right, y down, z forward, meters.
+struct synthetic_settings
+{
+    int width = 1280;
+    int height = 720;
+    int fps = 30;
+    float hfov_deg = 69.0f;          // horizontal field of view, depth and color share the same intrinsics
+
+    float plane_distance = 1.5f;     // background plane, perpendicular to the optical axis
+    float sphere_distance = 1.0f;    // z of the sphere center
+    float sphere_radius = 0.1f;
+    float orbit_x = 0.35f;           // the sphere center follows a Lissajous figure of this amplitude
+    float orbit_y = 0.15f;
+    float period_s = 4.0f;           // time for one horizontal sweep
+    unsigned char sphere_color[3] = { 220, 40, 40 };
+
+    float depth_units = 0.001f;
+};
+
+// Parses "WIDTHxHEIGHT@FPS", e.g. 848x480@90
+inline bool parse_synthetic_mode(const char* mode, synthetic_settings& settings)
+{
+    int w, h, fps;
+    if (std::sscanf(mode, "%dx%d@%d", &w, &h, &fps) != 3 || w <= 0 || h <= 0 || fps <= 0)
+        return false;
+    settings.width = w;
+    settings.height = h;
+    settings.fps = fps;
+    return true;
+}
+
+// Parses "R,G,B" with components in 0..255
+inline bool parse_rgb(const char* value, unsigned char rgb[3])
+{
+    int r, g, b;
+    if (std::sscanf(value, "%d,%d,%d", &r, &g, &b) != 3 ||
+        r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255)
+        return false;
+    rgb[0] = (unsigned char)r;
+    rgb[1] = (unsigned char)g;
+    rgb[2] = (unsigned char)b;
+    return true;
+}
+
+/// \brief Where the sphere really was when a frame was rendered
+struct ground_truth
+{
+    unsigned long long frame_number = 0;
+    float center[3];   // sphere center, camera coordinates
+    float surface[3];  // front surface point on the ray through the center, what the tracker deprojects
+    float pixel[2];    // projection of the center
+};
+
+/// \brief Renders a colored sphere moving over a checkered plane and feeds it as synchronized
+/// Z16 depth, RGB8 color and accel frames through rs2::software_device, paced at the configured
+/// frame rate like a real camera. The ground truth of every frame is kept (by frame number) for a
+/// short while so that tracking results can be scored when they come out of the pipeline.
+/// Needs no hardware: used to stress the pipeline at arbitrary resolutions and frame rates.
+class synthetic_scene
+{
+public:
+    explicit synthetic_scene(const synthetic_settings& settings)
+        : _settings(settings), _sync(4)
+    {
+        const float hfov = _settings.hfov_deg * 3.14159265f / 180.0f;
+        rs2_intrinsics intr = {};
+        intr.width = _settings.width;
+        intr.height = _settings.height;
+        intr.ppx = _settings.width / 2.0f;
+        intr.ppy = _settings.height / 2.0f;
+        intr.fx = intr.fy = _settings.width / 2.0f / std::tan(hfov / 2);
+        intr.model = RS2_DISTORTION_NONE;
+        _intrinsics = intr;
+
+        rs2_motion_device_intrinsic motion_intr = {};
+        for (int i = 0; i < 3; i++)
+            motion_intr.data[i][i] = 1.0f;
+
+        _depth_sensor = _dev.add_sensor("Synthetic Depth");
+        _color_sensor = _dev.add_sensor("Synthetic Color");
+        _motion_sensor = _dev.add_sensor("Synthetic Motion");
+
+        _depth_stream = _depth_sensor.add_video_stream({ RS2_STREAM_DEPTH, 0, 0, intr.width, intr.height, _settings.fps, 2, RS2_FORMAT_Z16, intr });
+        _color_stream = _color_sensor.add_video_stream({ RS2_STREAM_COLOR, 0, 1, intr.width, intr.height, _settings.fps, 3, RS2_FORMAT_RGB8, intr });
+        _accel_stream = _motion_sensor.add_motion_stream({ RS2_STREAM_ACCEL, 0, 2, _settings.fps, RS2_FORMAT_MOTION_XYZ32F, motion_intr });
+        _depth_sensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS, _settings.depth_units);
+
+        // Both video streams see the scene from the same point, align has nothing to move
+        _depth_stream.register_extrinsics_to(_color_stream, { { 1,0,0, 0,1,0, 0,0,1 }, { 0,0,0 } });
+        _dev.register_info(RS2_CAMERA_INFO_NAME, "Synthetic Scene");
+        _dev.create_matcher(RS2_MATCHER_DLR_C);
+    }
+
+    ~synthetic_scene() { stop(); }
+
+    void start()
+    {
+        _depth_sensor.open(_depth_stream);
+        _color_sensor.open(_color_stream);
+        _motion_sensor.open(_accel_stream);
+        _depth_sensor.start(_sync);
+        _color_sensor.start(_sync);
+        _motion_sensor.start(_sync);
+
+        _alive = true;
+        _generator = std::thread([this] { run(); });
+    }
+
+    void stop()
+    {
+        if (!_generator.joinable())
+            return;
+        _alive = false;
+        _generator.join();
+        _depth_sensor.stop();
+        _color_sensor.stop();
+        _motion_sensor.stop();
+        _depth_sensor.close();
+        _color_sensor.close();
+        _motion_sensor.close();
+    }
+
+    // Blocks for the next synchronized frameset, returns false on timeout
+    bool wait(rs2::frameset& data, unsigned int timeout_ms) { return _sync.try_wait_for_frames(&data, timeout_ms); }
+    bool poll(rs2::frameset& data) { return _sync.poll_for_frames(&data); }
+
+    rs2::device get_device() const { return _dev; }
+
+    rs2::stream_profile get_stream(rs2_stream type) const
+    {
+        switch (type)
+        {
+        case RS2_STREAM_DEPTH: return _depth_stream;
+        case RS2_STREAM_COLOR: return _color_stream;
+        case RS2_STREAM_ACCEL: return _accel_stream;
+        default: throw std::runtime_error(std::string("Synthetic scene has no ") + rs2_stream_to_string(type) + " stream");
+        }
+    }
+
+    const synthetic_settings& settings() const { return _settings; }
+
+    // Ground truth of a frame that was rendered recently, false if it is no longer (or not yet) known
+    bool get_ground_truth(unsigned long long frame_number, ground_truth& out) const
+    {
+        std::lock_guard<std::mutex> lock(_truth_mutex);
+        const auto& entry = _truth[frame_number % TRUTH_HISTORY];
+        if (entry.frame_number != frame_number)
+            return false;
+        out = entry;
+        return true;
+    }
+
+    void report(std::ostream& out) const
+    {
+        out << "Synthetic scene: " << _frames.load() << " frames at " << _settings.width << "x" << _settings.height
+            << "@" << _settings.fps << ", " << _late.load() << " rendered too late to keep the frame rate";
+        if (_frames)
+            out << ", render avg " << std::fixed << std::setprecision(2) << _render_us.load() / 1000.0 / _frames << " ms";
+        out << std::endl;
+    }
+
+private:
+    // Frames are numbered from 1, so the zero-initialized history entries never match
+    static const unsigned TRUTH_HISTORY = 256;
+
+    void run()
+    {
+        using clock = std::chrono::steady_clock;
+        const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / _settings.fps));
+        const auto start = clock::now();
+        auto deadline = start;
+        unsigned long long frame_number = 0;
+
+        while (_alive)
+        {
+            std::this_thread::sleep_until(deadline);
+            ++frame_number;
+            double t = std::chrono::duration<double>(deadline - start).count();
+            auto render_start = clock::now();
+            emit(frame_number, t);
+            _render_us += std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - render_start).count();
+            _frames++;
+
+            deadline += period;
+            if (clock::now() > deadline)
+            {
+                // Behind schedule, skip ahead instead of bursting to catch up (a camera drops frames too)
+                _late++;
+                deadline = clock::now();
+            }
+        }
+    }
+
+    void emit(unsigned long long frame_number, double t)
+    {
+        const int w = _settings.width, h = _settings.height;
+        auto depth = new uint16_t[size_t(w) * h];
+        auto color = new uint8_t[size_t(w) * h * 3];
+        auto accel = new float[3];
+
+        ground_truth truth;
+        truth.frame_number = frame_number;
+        render(t, depth, color, truth);
+        {
+            std::lock_guard<std::mutex> lock(_truth_mutex);
+            _truth[frame_number % TRUTH_HISTORY] = truth;
+        }
+
+        // Camera standing level, gravity along -y as the D435i IMU reports it
+        accel[0] = 0.0f; accel[1] = -9.81f; accel[2] = 0.0f;
+
+        // Host time stamps, so the acquisition meter can measure latency
+        double timestamp = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now().time_since_epoch()).count();
+        int number = int(frame_number);
+
+        _depth_sensor.on_video_frame({ depth, [](void* p) { delete[] (uint16_t*)p; }, w * 2, 2,
+            timestamp, RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME, number, _depth_stream.get(), _settings.depth_units });
+        _color_sensor.on_video_frame({ color, [](void* p) { delete[] (uint8_t*)p; }, w * 3, 3,
+            timestamp, RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME, number, _color_stream.get() });
+        _motion_sensor.on_motion_frame({ accel, [](void* p) { delete[] (float*)p; },
+            timestamp, RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME, number, _accel_stream.get() });
+    }
+
+    // Ray casts the scene: a sphere in front of a checkered plane, lit from the upper left
+    void render(double t, uint16_t* depth, uint8_t* color, ground_truth& truth) const
+    {
+        const auto& s = _settings;
+        const auto& intr = _intrinsics;
+        const double w = 2 * 3.14159265358979 / s.period_s;
+
+        const float c[3] = { float(s.orbit_x * std::sin(w * t)), float(s.orbit_y * std::sin(2 * w * t)), s.sphere_distance };
+        const float r = s.sphere_radius;
+        const float cc = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+        const float c_len = std::sqrt(cc);
+
+        for (int i = 0; i < 3; i++)
+        {
+            truth.center[i] = c[i];
+            truth.surface[i] = c[i] * (1 - r / c_len);
+        }
+        truth.pixel[0] = c[0] / c[2] * intr.fx + intr.ppx;
+        truth.pixel[1] = c[1] / c[2] * intr.fy + intr.ppy;
+
+        // Only the rows and columns the sphere can cover need the intersection test
+        const float reach = intr.fx * r / (c[2] - r) + 2;
+        const int u0 = std::max(0, int(truth.pixel[0] - reach)), u1 = std::min(s.width, int(truth.pixel[0] + reach) + 1);
+        const int v0 = std::max(0, int(truth.pixel[1] - reach)), v1 = std::min(s.height, int(truth.pixel[1] + reach) + 1);
+
+        const float light[3] = { -0.36f, -0.48f, -0.8f }; // unit vector from the surface towards the light
+        const uint16_t plane_depth = uint16_t(s.plane_distance / s.depth_units + 0.5f);
+        const float checker = 0.1f;
+
+        for (int v = 0; v < s.height; v++)
+        {
+            const float yn = (v - intr.ppy) / intr.fy;
+            const int row_checker = int(std::floor(yn * s.plane_distance / checker));
+            uint16_t* depth_row = depth + size_t(v) * s.width;
+            uint8_t* color_row = color + size_t(v) * s.width * 3;
+
+            for (int u = 0; u < s.width; u++)
+            {
+                const float xn = (u - intr.ppx) / intr.fx;
+                bool hit = false;
+                if (v >= v0 && v < v1 && u >= u0 && u < u1)
+                {
+                    // |z * (xn, yn, 1) - c|^2 = r^2, nearest root
+                    const float a = xn * xn + yn * yn + 1;
+                    const float b = xn * c[0] + yn * c[1] + c[2];
+                    const float disc = b * b - a * (cc - r * r);
+                    if (disc >= 0)
+                    {
+                        const float z = (b - std::sqrt(disc)) / a;
+                        const float n[3] = { (xn * z - c[0]) / r, (yn * z - c[1]) / r, (z - c[2]) / r };
+                        const float lambert = std::max(0.0f, n[0] * light[0] + n[1] * light[1] + n[2] * light[2]);
+                        const float shade = 0.6f + 0.4f * lambert;
+                        depth_row[u] = uint16_t(z / s.depth_units + 0.5f);
+                        for (int k = 0; k < 3; k++)
+                            color_row[u * 3 + k] = uint8_t(s.sphere_color[k] * shade);
+                        hit = true;
+                    }
+                }
+                if (!hit)
+                {
+                    const int col_checker = int(std::floor(xn * s.plane_distance / checker));
+                    const uint8_t grey = ((row_checker + col_checker) & 1) ? 170 : 110;
+                    depth_row[u] = plane_depth;
+                    color_row[u * 3 + 0] = color_row[u * 3 + 1] = color_row[u * 3 + 2] = grey;
+                }
+            }
+        }
+    }
+
+    synthetic_settings _settings;
+    rs2_intrinsics _intrinsics;
+
+    rs2::software_device _dev;
+    rs2::software_sensor _depth_sensor, _color_sensor, _motion_sensor;
+    rs2::stream_profile _depth_stream, _color_stream, _accel_stream;
+    rs2::syncer _sync;
+
+    std::thread _generator;
+    std::atomic_bool _alive{ false };
+    std::atomic<unsigned long long> _frames{ 0 };
+    std::atomic<unsigned long long> _late{ 0 };
+    std::atomic<unsigned long long> _render_us{ 0 };
+
+    mutable std::mutex _truth_mutex;
+    ground_truth _truth[TRUTH_HISTORY];
+};
+
+/// \brief Scores tracking results against the synthetic ground truth
+class tracking_accuracy
+{
+public:
+    // pixel is the reported blob center, point the deprojected 3D point (nullptr if depth was invalid)
+    void add(const ground_truth& truth, const float pixel[2], const float* point)
+    {
+        _tracked++;
+        float du = pixel[0] - truth.pixel[0], dv = pixel[1] - truth.pixel[1];
+        float pixel_error = std::sqrt(du * du + dv * dv);
+        _pixel_sum += pixel_error;
+        _pixel_max = std::max(_pixel_max, pixel_error);
+        if (!point)
+            return;
+        _located++;
+        float dx = point[0] - truth.surface[0], dy = point[1] - truth.surface[1], dz = point[2] - truth.surface[2];
+        float error_mm = 1000.0f * std::sqrt(dx * dx + dy * dy + dz * dz);
+        _point_sum += error_mm;
+        _point_max = std::max(_point_max, error_mm);
+    }
+
+    // A frame with known ground truth in which the tracker had no blob
+    void add_missed() { _missed++; }
+
+    void report(std::ostream& out) const
+    {
+        out << "Tracking accuracy: " << _tracked << " frames tracked, " << _missed << " missed";
+        if (_tracked)
+            out << ", pixel error avg " << std::fixed << std::setprecision(2) << _pixel_sum / _tracked << " px, max " << _pixel_max << " px";
+        if (_located)
+            out << ", 3D error avg " << std::fixed << std::setprecision(1) << _point_sum / _located << " mm, max " << _point_max << " mm";
+        out << std::endl;
+    }
+
+private:
+    unsigned long long _tracked = 0, _located = 0, _missed = 0;
+    double _pixel_sum = 0.0, _point_sum = 0.0;
+    float _pixel_max = 0.0f, _point_max = 0.0f;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include "latency-stats.hpp"   // monotonic_us, frame_key
+#include "tracking-output.hpp" // spsc_ring
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+
+//////////////////////////////
+// Trace export             //
+//////////////////////////////
+
+/// \brief Records begin/end spans from any thread and streams them to a Chrome Trace Event JSON file,
+/// which chrome://tracing and ui.perfetto.dev open directly (one track per thread, spans nest by time).
+/// Recording a span is a push into a ring owned by the calling thread, formatting and file I/O happen
+/// on a writer thread of its own, so tracing barely moves the timings it records. Spans are dropped
+/// (and counted) rather than blocking if a thread outruns the writer by a whole ring.
+class trace_recorder
+{
+public:
+    // Spans a thread can record between two flushes of the writer thread
+    static const size_t RING = 4096;
+    // How often the writer thread collects the spans
+    static const unsigned FLUSH_MS = 20;
+    // Passed as frame for spans that do not belong to a frame
+    static const unsigned long long NO_FRAME = ~0ULL;
+
+    explicit trace_recorder(const std::string& path)
+        : _path(path), _id(next_id()), _origin_us(monotonic_us()), _file_buffer(1 << 20)
+    {
+        _file.open(path, std::ios::out | std::ios::trunc);
+        if (!_file)
+            throw std::runtime_error("Can not write trace file " + path);
+        // after open() and before the first write: MSVC's filebuf ignores a buffer given to a closed file
+        _file.rdbuf()->pubsetbuf(_file_buffer.data(), std::streamsize(_file_buffer.size()));
+        _file << "[\n";
+        write_metadata(0, "process_name", "RealSense pipeline");
+        _writer = std::thread([this] { run_writer(); });
+    }
+
+    ~trace_recorder() { close(); }
+
+    trace_recorder(const trace_recorder&) = delete;
+    trace_recorder& operator=(const trace_recorder&) = delete;
+
+    // Names the track of the calling thread
+    void name_thread(const std::string& name)
+    {
+        auto& ch = local_channel();
+        std::lock_guard<std::mutex> lock(_channels_mutex);
+        ch.name = name;
+    }
+
+    // Records a span of the calling thread. name has to outlive the recorder (a literal or a filter name).
+    // Times are monotonic_us() values
+    void span(const char* name, unsigned long long frame, long long begin_us, long long end_us)
+    {
+        event e;
+        e.name = name;
+        e.frame = frame;
+        e.begin_us = begin_us;
+        e.end_us = end_us;
+        local_channel().events.push(e);
+    }
+
+    // Stops the writer thread, writes the remaining spans and the thread names and closes the file
+    void close()
+    {
+        if (!_writer.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(_wake_mutex);
+            _stop = true;
+        }
+        _wake.notify_all();
+        _writer.join();
+
+        std::lock_guard<std::mutex> lock(_channels_mutex);
+        flush_channels();
+        for (auto& ch : _channels)
+        {
+            if (!ch->name.empty())
+                write_metadata(ch->tid, "thread_name", ch->name.c_str());
+            _dropped += ch->events.dropped();
+        }
+        _file << "\n]\n";
+        _file.close();
+    }
+
+    void report(std::ostream& out) const
+    {
+        out << "Trace: " << _written << " spans written to " << _path << ", " << _dropped << " dropped" << std::endl;
+    }
+
+private:
+    struct event
+    {
+        const char* name;
+        unsigned long long frame;
+        long long begin_us;
+        long long end_us;
+    };
+
+    struct channel
+    {
+        unsigned tid;
+        std::string name;
+        spsc_ring<event, RING> events;
+
+        // The ring keeps its indices on separate cache lines, which plain new only honours from C++17 on
+        static void* operator new(size_t size)
+        {
+            auto raw = static_cast<char*>(::operator new(size + alignof(channel) + sizeof(void*)));
+            auto aligned = raw + sizeof(void*);
+            aligned += (alignof(channel) - reinterpret_cast<uintptr_t>(aligned) % alignof(channel)) % alignof(channel);
+            reinterpret_cast<void**>(aligned)[-1] = raw;
+            return aligned;
+        }
+        static void operator delete(void* p) { ::operator delete(static_cast<void**>(p)[-1]); }
+    };
+
+    static unsigned long long next_id()
+    {
+        static std::atomic<unsigned long long> id{ 0 };
+        return ++id;
+    }
+
+    // Ring of the calling thread, registered on its first span
+    channel& local_channel()
+    {
+        thread_local unsigned long long owner = 0;
+        thread_local channel* local = nullptr;
+        if (owner != _id)
+        {
+            std::lock_guard<std::mutex> lock(_channels_mutex);
+            _channels.emplace_back(new channel());
+            _channels.back()->tid = unsigned(_channels.size());
+            local = _channels.back().get();
+            owner = _id;
+        }
+        return *local;
+    }
+
+    void run_writer()
+    {
+        std::unique_lock<std::mutex> wake_lock(_wake_mutex);
+        while (!_stop)
+        {
+            _wake.wait_for(wake_lock, std::chrono::milliseconds(FLUSH_MS), [this] { return _stop; });
+            std::lock_guard<std::mutex> lock(_channels_mutex);
+            flush_channels();
+        }
+    }
+
+    // Called with _channels_mutex held
+    void flush_channels()
+    {
+        char line[256];
+        for (auto& ch : _channels)
+        {
+            ch->events.drain([&](const event& e) {
+                int n;
+                if (e.frame != NO_FRAME)
+                    n = std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"args\":{\"frame\":%llu}}",
+                        separator(), e.name, ch->tid, e.begin_us - _origin_us, e.end_us - e.begin_us, e.frame);
+                else
+                    n = std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+                        separator(), e.name, ch->tid, e.begin_us - _origin_us, e.end_us - e.begin_us);
+                _file.write(line, std::min<std::streamsize>(n, sizeof(line) - 1));
+                _written++;
+            });
+        }
+    }
+
+    void write_metadata(unsigned tid, const char* kind, const char* name)
+    {
+        char line[256];
+        int n = std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            separator(), kind, tid, name);
+        _file.write(line, std::min<std::streamsize>(n, sizeof(line) - 1));
+    }
+
+    const char* separator()
+    {
+        if (_first)
+        {
+            _first = false;
+            return "";
+        }
+        return ",\n";
+    }
+
+    std::string _path;
+    unsigned long long _id;
+    long long _origin_us;
+    std::vector<char> _file_buffer;
+    std::ofstream _file;
+    bool _first = true;
+    unsigned long long _written = 0;
+    unsigned long long _dropped = 0;
+
+    std::mutex _channels_mutex;
+    std::vector<std::unique_ptr<channel>> _channels;
+
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;
+    bool _stop = false;
+    std::thread _writer;
+};
+
+/// \brief Records a span from construction to end() or destruction. Does nothing without a recorder,
+/// so call sites stay the same whether tracing is on or off
+class trace_span
+{
+public:
+    trace_span(trace_recorder* recorder, const char* name, unsigned long long frame = trace_recorder::NO_FRAME)
+        : _recorder(recorder), _name(name), _frame(frame), _begin_us(recorder ? monotonic_us() : 0) {}
+
+    ~trace_span() { end(); }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+    void end()
+    {
+        if (!_recorder) return;
+        _recorder->span(_name, _frame, _begin_us, monotonic_us());
+        _recorder = nullptr;
+    }
+
+private:
+    trace_recorder* _recorder;
+    const char* _name;
+    unsigned long long _frame;
+    long long _begin_us;
+};
+
+// Pass --trace <file.json> to record a trace of the pipeline
+inline std::unique_ptr<trace_recorder> trace_from_command_line(int argc, char* argv[])
+{
+    std::unique_ptr<trace_recorder> recorder;
+    if (auto path = flag_value(argc, argv, "--trace"))
+        recorder.reset(new trace_recorder(path));
+    return recorder;
+}
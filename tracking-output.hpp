@@ -0,0 +1,135 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+#include "shared-pose.hpp"
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <algorithm>
+
+//////////////////////////////
+// Tracking output          //
+//////////////////////////////
+
+/// \brief One tracking result, as handed to whoever drives the robot
+struct tracked_point
+{
+    unsigned long long frame_number = 0;
+    double timestamp = 0;            // sensor timestamp of the color frame, ms
+    rs2_timestamp_domain domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+    float pixel[2] = { 0, 0 };       // blob center in color pixels
+    float camera[3] = { 0, 0, 0 };   // camera frame, m
+    float robot[3] = { 0, 0, 0 };    // robot frame (after transformPoint), m
+    bool valid = false;              // false while the blob is lost or has no valid depth
+};
+
+/// \brief Fixed-capacity single-producer / single-consumer ring.
+/// push and pop are wait-free and never allocate: each side only writes its own index and reads the
+/// other one, and the indices live on separate cache lines so the two threads do not contend.
+/// Unlike latest_mailbox every item is kept in order, the producer only loses items if the consumer
+/// falls a whole ring behind.
+template<class T, size_t Capacity>
+class spsc_ring
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer side. Returns false (and counts the item as dropped) if the ring is full
+    bool push(const T& item)
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == Capacity)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _items[head & (Capacity - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if there is nothing to take
+    bool pop(T& item)
+    {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) == tail)
+            return false;
+        item = _items[tail & (Capacity - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Calls f for every item available right now, returns how many there were
+    template<class F>
+    size_t drain(F f)
+    {
+        size_t count = 0;
+        T item;
+        while (pop(item))
+        {
+            f(item);
+            count++;
+        }
+        return count;
+    }
+
+    // Approximate when read from the other side
+    size_t size() const { return size_t(_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire)); }
+    static constexpr size_t capacity() { return Capacity; }
+
+    unsigned long long pushed() const { return _head.load(std::memory_order_relaxed); }
+    unsigned long long dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    alignas(64) std::atomic<unsigned long long> _head{ 0 }; // written by the producer
+    alignas(64) std::atomic<unsigned long long> _tail{ 0 }; // written by the consumer
+    alignas(64) std::atomic<unsigned long long> _dropped{ 0 };
+    std::array<T, Capacity> _items;
+};
+
+// Fixed-width copy for the shared-memory segment read by other processes
+inline shared_pose_record to_shared_pose(const tracked_point& p)
+{
+    shared_pose_record record;
+    record.frame_number = p.frame_number;
+    record.timestamp = p.timestamp;
+    record.timestamp_domain = int32_t(p.domain);
+    record.valid = p.valid ? 1 : 0;
+    std::copy(p.pixel, p.pixel + 2, record.pixel);
+    std::copy(p.camera, p.camera + 3, record.camera);
+    std::copy(p.robot, p.robot + 3, record.robot);
+    return record;
+}
+
+// Results published by the tracking thread, a second's worth at 90 fps with room to spare
+using tracking_output = spsc_ring<tracked_point, 128>;
+
+/// \brief Minimal consumer side: keeps the last valid point and counts what it has seen.
+/// Stands in for the robot controller, which would act on every point it pops.
+class tracking_consumer
+{
+public:
+    void consume(const tracked_point& p)
+    {
+        _results++;
+        if (!p.valid)
+            return;
+        _valid++;
+        _last = p;
+    }
+
+    const tracked_point& last_valid() const { return _last; }
+
+    void report(std::ostream& out, const tracking_output& ring) const
+    {
+        out << "Tracking output: " << _results << " results consumed (" << _valid << " valid), "
+            << ring.dropped() << " dropped because the consumer fell behind" << std::endl;
+    }
+
+private:
+    unsigned long long _results = 0;
+    unsigned long long _valid = 0;
+    tracked_point _last;
+};